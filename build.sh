@@ -0,0 +1,24 @@
+#!/bin/sh
+# Linux build, the counterpart of debug.bat and release.bat: ./build.sh [debug|release]
+#
+# The platform is headless on Linux (see lk_platform.h), so the game only ever draws with the software
+# renderer there. The game library is still compiled against GLEW for the OpenGL renderer, and its
+# function pointers have to resolve when the library is loaded, so libGLEW and libGL are needed at run
+# time even though no GL call is made (libglew-dev and libgl-dev on Debian and Ubuntu).
+set -e
+
+cd "$(dirname "$0")"
+
+case "${1:-debug}" in
+    debug)   options="-g -O1" ;;
+    release) options="-O2" ;;
+    *)       echo "usage: $0 [debug|release]"; exit 1 ;;
+esac
+
+gcc $options -o run_tree/ld41 src/platform/ld41_platform.c -ldl
+
+# The platform reloads the game library when it changes, so it's replaced in one rename rather than
+# written in place under a running game.
+g++ $options -std=c++14 -shared -fPIC -fvisibility=hidden -fno-rtti -DGLEW_STATIC \
+    -o run_tree/ld41_game_build.so src/game/ld41.cpp -lGLEW -lGL -lpthread
+mv run_tree/ld41_game_build.so run_tree/ld41_game.so
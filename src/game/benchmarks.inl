@@ -0,0 +1,685 @@
+// Timings for the hot paths of the game, only built when LD41_BENCHMARKS is defined. They run once at
+// startup and print to stdout, then the game starts as usual. Most of them also check that the new version
+// of the code gives the same results as the old one, and if any check fails the game exits with 1 once
+// they're all done.
+// Results are written here so the work that produced them isn't optimized away.
+static volatile float benchmark_sink;
+static int benchmark_mismatch_count;
+
+static double get_benchmark_seconds()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration<double>(now).count();
+}
+
+typedef void Scratch_Game_Function(Game* game);
+
+// Runs a benchmark that needs a level on a new Game, which is the_game until it returns and is freed
+// after, level tiles included. The game that was there before is left alone.
+static void with_scratch_game(LK_Platform* platform, Scratch_Game_Function* function)
+{
+    Game* previous_game = the_game;
+    Game* game = new Game();
+    game->platform = platform;
+    the_game = game;
+
+    function(game);
+
+    delete[] game->level.tiles;
+    delete game;
+    the_game = previous_game;
+}
+
+static Entity make_benchmark_entity(int i)
+{
+    Entity entity = {};
+    entity.brain = (i % 2) ? BRAIN_FIREBALL : BRAIN_MONSTER;
+    entity.position = vector2(i % 64, (i / 64) % 64);
+    entity.size = vector2(1, 1);
+    entity.health = 1;
+    entity.max_health = 1;
+    return entity;
+}
+
+// Half of the entities are fireballs and all of them expire in the same update. Erasing from a vector
+// costs more per fireball the more entities there are, the remove queue should cost the same.
+static void benchmark_fireball_removal()
+{
+    printf("Removing every fireball in one update:\n");
+    printf("%10s %22s %22s\n", "entities", "set + erase (ns each)", "remove queue (ns each)");
+
+    for (int count = 1000; count <= 16000; count *= 2)
+    {
+        int fireball_count = count / 2;
+
+        std::vector<Entity> list;
+        for (int i = 0; i < count; i++)
+        {
+            list.push_back(make_benchmark_entity(i));
+        }
+
+        double start = get_benchmark_seconds();
+        std::set<int> erase_after_update;
+        for (int i = 0; i < count; i++)
+        {
+            if (list[i].brain == BRAIN_FIREBALL) erase_after_update.insert(i);
+        }
+        for (auto it = erase_after_update.rbegin(); it != erase_after_update.rend(); it++)
+        {
+            list.erase(list.begin() + *it);
+        }
+        double erase_time = get_benchmark_seconds() - start;
+
+        Entity_Storage entities = {};
+        for (int i = 0; i < count; i++)
+        {
+            add_entity(&entities, make_benchmark_entity(i));
+        }
+
+        start = get_benchmark_seconds();
+        for (int index : entities.by_brain[BRAIN_FIREBALL])
+        {
+            remove_entity_later(&entities, index);
+        }
+        remove_queued_entities(&entities);
+        double queue_time = get_benchmark_seconds() - start;
+
+        if ((int) list.size() != entities.count)
+        {
+            printf("Mismatch: %d entities left after erase, %d after remove queue\n", (int) list.size(), entities.count);
+            benchmark_mismatch_count++;
+        }
+
+        printf("%10d %22.1f %22.1f\n", count,
+               erase_time * 1e9 / fireball_count, queue_time * 1e9 / fireball_count);
+    }
+}
+
+// The tile collision move_entity had before the swept version, for comparison. Moves longer than
+// MAX_MOVE_DISTANCE are split up recursively, and every piece is pushed out of all overlapping tiles.
+static float collide_aabb_aabb_axis(float center1, float size1, float center2, float size2)
+{
+    if (center1 < center2)
+    {
+        float my_right = center1 + size1 * 0.5;
+        float their_left = center2 - size2 * 0.5;
+        return their_left - my_right;
+    }
+    else
+    {
+        float my_left = center1 - size1 * 0.5;
+        float their_right = center2 + size2 * 0.5;
+        return their_right - my_left;
+    }
+}
+
+static Vector2 collide_aabb_aabb(Vector2 center1, Vector2 size1, Vector2 center2, Vector2 size2)
+{
+    if (!intersect_aabb_aabb(center1, size1, center2, size2))
+    {
+        return center1;
+    }
+
+    float x_axis = collide_aabb_aabb_axis(center1.x, size1.x, center2.x, size2.x);
+    float y_axis = collide_aabb_aabb_axis(center1.y, size1.y, center2.y, size2.y);
+
+    if (fabs(x_axis) < fabs(y_axis))
+    {
+        center1.x += x_axis;
+    }
+    else
+    {
+        center1.y += y_axis;
+    }
+
+    return center1;
+}
+
+static Vector2 move_entity_subdivided(Vector2 position, Vector2 size, Vector2 delta)
+{
+    auto& level = the_game->level;
+
+    const float MAX_MOVE_DISTANCE = 0.1;
+    float distance = length(delta);
+    if (distance > MAX_MOVE_DISTANCE)
+    {
+        Vector2 my_delta = noz(delta) * MAX_MOVE_DISTANCE;
+        position = move_entity_subdivided(position, size, delta - my_delta);
+
+        distance = MAX_MOVE_DISTANCE;
+        delta = my_delta;
+    }
+
+    position += delta;
+    Vector2 min_extreme = position - size * 0.5;
+    Vector2 max_extreme = position + size * 0.5;
+
+    int min_x = max_i32((int)(floorf(min_extreme.x) + 0.5f), 0);
+    int min_y = max_i32((int)(floorf(min_extreme.y) + 0.5f), 0);
+    int max_x = min_i32((int)(ceilf (max_extreme.x) + 0.5f), level.width  - 1);
+    int max_y = min_i32((int)(ceilf (max_extreme.y) + 0.5f), level.height - 1);
+
+    for (int y = min_y; y <= max_y; y++)
+    {
+        for (int x = min_x; x <= max_x; x++)
+        {
+            Tile* tile = level.tiles + y * level.width + x;
+            if (!tile->z) continue;
+
+            Vector2 tile_center = vector2(x + 0.5f, y + 0.5f);
+            Vector2 tile_size = { 1, 1 };
+
+            position = collide_aabb_aabb(position, size, tile_center, tile_size);
+        }
+    }
+
+    return position;
+}
+
+// Whether the box overlaps a solid tile by more than the skin move_entity leaves between them.
+static bool is_box_in_solid_tile(Vector2 center, Vector2 size)
+{
+    auto& level = the_game->level;
+    int min_x = max_i32((int) floorf(center.x - size.x * 0.5f + COLLISION_SKIN * 0.5f), 0);
+    int min_y = max_i32((int) floorf(center.y - size.y * 0.5f + COLLISION_SKIN * 0.5f), 0);
+    int max_x = min_i32((int) ceilf (center.x + size.x * 0.5f - COLLISION_SKIN * 0.5f) - 1, level.width  - 1);
+    int max_y = min_i32((int) ceilf (center.y + size.y * 0.5f - COLLISION_SKIN * 0.5f) - 1, level.height - 1);
+
+    for (int y = min_y; y <= max_y; y++)
+    {
+        for (int x = min_x; x <= max_x; x++)
+        {
+            if (is_tile_solid(x, y)) return true;
+        }
+    }
+    return false;
+}
+
+// Random open and solid tiles with a solid border, the way generate_level_cave would leave them, and
+// boxes starting in the middle of open tiles moving in random directions. The swept moves must never end
+// inside a tile, however fast they go.
+static void benchmark_tile_collision(Game* game)
+{
+    Random random = seed_random(1);
+
+    auto& level = game->level;
+    level.width = 64;
+    level.height = 64;
+    level.tiles = new Tile[level.width * level.height];
+    for (int y = 0; y < level.height; y++)
+    {
+        for (int x = 0; x < level.width; x++)
+        {
+            bool border = (x == 0 || y == 0 || x == level.width - 1 || y == level.height - 1);
+            level.tiles[y * level.width + x].z = (border || random_float(&random) < 0.3f) ? 1 : 0;
+        }
+    }
+    tiles_changed(0, 0, level.width - 1, level.height - 1);
+
+    const int MOVE_COUNT = 100000;
+    std::vector<Vector2> starts;
+    std::vector<Vector2> directions;
+    while (starts.size() < MOVE_COUNT)
+    {
+        int x = random_int(&random, level.width - 1);
+        int y = random_int(&random, level.height - 1);
+        if (level.tiles[y * level.width + x].z) continue;
+
+        starts.push_back(vector2(x + 0.5f, y + 0.5f));
+        float angle = random_float(&random) * 360 * DEG2RAD;
+        directions.push_back(vector2(cosf(angle), sinf(angle)));
+    }
+    Vector2 size = vector2(0.8f, 0.8f);
+
+    printf("Moving a box through tiles for one simulation step:\n");
+    printf("%16s %22s %22s\n", "speed (tiles/s)", "subdivided (ns each)", "swept (ns each)");
+
+    float speeds[] = { 6, 10, 60, 240, 960 };
+    for (float speed : speeds)
+    {
+        float distance = speed * SIMULATION_STEP;
+
+        float checksum = 0;
+
+        double start = get_benchmark_seconds();
+        for (int i = 0; i < MOVE_COUNT; i++)
+        {
+            checksum += move_entity_subdivided(starts[i], size, directions[i] * distance).x;
+        }
+        double subdivided_time = get_benchmark_seconds() - start;
+
+        start = get_benchmark_seconds();
+        for (int i = 0; i < MOVE_COUNT; i++)
+        {
+            checksum += move_entity(starts[i], size, directions[i] * distance).x;
+        }
+        double swept_time = get_benchmark_seconds() - start;
+
+        benchmark_sink = checksum;
+        printf("%16.0f %22.1f %22.1f\n", speed, subdivided_time * 1e9 / MOVE_COUNT, swept_time * 1e9 / MOVE_COUNT);
+
+        int inside_count = 0;
+        for (int i = 0; i < MOVE_COUNT; i++)
+        {
+            inside_count += is_box_in_solid_tile(move_entity(starts[i], size, directions[i] * distance), size);
+        }
+        if (inside_count)
+        {
+            printf("Mismatch: %d swept moves at %.0f tiles/s end inside a tile\n", inside_count, speed);
+            benchmark_mismatch_count++;
+        }
+    }
+}
+
+// The cave automaton as it was before it worked on whole words, one bounds checked read per neighbor.
+static int generator_count_neighbors_scalar(Bit_Grid* read, int x, int y)
+{
+    int width = read->width;
+    int height = read->height;
+    int count = 0;
+
+    for (int dy = -1; dy <= 1; dy++)
+    {
+        for (int dx = -1; dx <= 1; dx++)
+        {
+            int nx = x + dx;
+            int ny = y + dy;
+            if (nx < 0 || ny < 0 || nx >= width || ny >= height)
+            {
+                count++;
+            }
+            else
+            {
+                count += get_bit(read, nx, ny);
+            }
+        }
+    }
+
+    return count;
+}
+
+static void generator_step_scalar(Bit_Grid* read, Bit_Grid* write, int birth_limit, int death_limit)
+{
+    for (int y = 0; y < read->height; y++)
+    {
+        for (int x = 0; x < read->width; x++)
+        {
+            int count = generator_count_neighbors_scalar(read, x, y);
+
+            if (get_bit(read, x, y))
+            {
+                set_bit(write, x, y, count > death_limit);
+            }
+            else
+            {
+                set_bit(write, x, y, count > birth_limit);
+            }
+        }
+    }
+}
+
+// The five automaton iterations of generate_level_cave on random grids, both versions have to agree.
+static void benchmark_cave_automaton()
+{
+    printf("Running the cave automaton for 5 iterations:\n");
+    printf("%10s %22s %22s\n", "size", "scalar (us)", "bit sliced (us)");
+
+    Random random = seed_random(1);
+
+    for (int size = 64; size <= 1024; size *= 2)
+    {
+        Bit_Grid seed = {};
+        resize_bit_grid(&seed, size, size);
+        for (int y = 0; y < size; y++)
+        {
+            for (int x = 0; x < size; x++)
+            {
+                set_bit(&seed, x, y, random_float(&random) < 0.4f);
+            }
+        }
+
+        Bit_Grid scalar_read = seed;
+        Bit_Grid scalar_write = seed;
+        double start = get_benchmark_seconds();
+        for (int step = 0; step < 5; step++)
+        {
+            std::swap(scalar_read, scalar_write);
+            generator_step_scalar(&scalar_read, &scalar_write, 4, 3);
+        }
+        double scalar_time = get_benchmark_seconds() - start;
+
+        Bit_Grid sliced_read = seed;
+        Bit_Grid sliced_write = seed;
+        start = get_benchmark_seconds();
+        for (int step = 0; step < 5; step++)
+        {
+            std::swap(sliced_read, sliced_write);
+            generator_step(&sliced_read, &sliced_write, 0, size, 4, 3);
+        }
+        double sliced_time = get_benchmark_seconds() - start;
+
+        if (scalar_write.words != sliced_write.words)
+        {
+            printf("Mismatch between the scalar and bit sliced automaton at size %d\n", size);
+            benchmark_mismatch_count++;
+        }
+
+        char label[32];
+        snprintf(label, sizeof(label), "%dx%d", size, size);
+        printf("%10s %22.1f %22.1f\n", label, scalar_time * 1e6, sliced_time * 1e6);
+    }
+}
+
+// A whole generate_level_cave, the automaton and treasure pass are spread over the worker threads.
+static void benchmark_level_generation(Game* game)
+{
+    printf("Generating a cave level with %d worker threads:\n", get_worker_count());
+    printf("%10s %22s\n", "size", "time (ms)");
+
+    for (int size = 256; size <= 2048; size *= 2)
+    {
+        double start = get_benchmark_seconds();
+        generate_level_cave(size, size, 1);
+        double time = get_benchmark_seconds() - start;
+
+        char label[32];
+        snprintf(label, sizeof(label), "%dx%d", size, size);
+        printf("%10s %22.1f\n", label, time * 1e3);
+    }
+}
+
+// What random_int and random_float used to be, against a Random one at a time and in a batch. Random has
+// to give the same numbers as the reference PCG32, and random_floats the same ones as random_float.
+static void benchmark_random()
+{
+    const int COUNT = 1000000;
+    std::vector<float> floats(COUNT);
+    Random random = seed_random(1);
+
+    double start = get_benchmark_seconds();
+    for (int i = 0; i < COUNT; i++)
+    {
+        floats[i] = (float) rand() / (float) RAND_MAX;
+    }
+    double rand_time = get_benchmark_seconds() - start;
+
+    start = get_benchmark_seconds();
+    for (int i = 0; i < COUNT; i++)
+    {
+        floats[i] = random_float(&random);
+    }
+    double single_time = get_benchmark_seconds() - start;
+
+    start = get_benchmark_seconds();
+    random_floats(&random, floats.data(), COUNT);
+    double batch_time = get_benchmark_seconds() - start;
+    benchmark_sink = floats[COUNT / 2];
+
+    printf("Random floats: rand() %.2f ns, random_float %.2f ns, random_floats %.2f ns each\n",
+           rand_time * 1e9 / COUNT, single_time * 1e9 / COUNT, batch_time * 1e9 / COUNT);
+
+    // The first outputs of pcg32_srandom_r(42, 54) in the PCG32 reference code.
+    uint32 expected[] = { 0xA15C02B7, 0x7B47F409, 0xBA1D3330, 0x83D2F293, 0xBFA4784B, 0xCBED606E };
+    Random reference = seed_random(42, 54);
+    for (uint32 value : expected)
+    {
+        if (next_random(&reference) != value)
+        {
+            printf("Mismatch between Random and the reference PCG32\n");
+            benchmark_mismatch_count++;
+            break;
+        }
+    }
+
+    Random single = seed_random(7);
+    Random batch = seed_random(7);
+    random_floats(&batch, floats.data(), COUNT);
+    for (int i = 0; i < COUNT; i++)
+    {
+        if (floats[i] != random_float(&single))
+        {
+            printf("Mismatch between random_floats and random_float at %d\n", i);
+            benchmark_mismatch_count++;
+            break;
+        }
+    }
+}
+
+// Loading the level image against the level file converted from it, and level files of generated caves,
+// which have to load back the same.
+static void benchmark_level_loading(Game* game)
+{
+    const char* IMAGE_PATH = "data/level/level.png";
+    const char* FILE_PATH = "benchmark_level.lvl";
+    const int LOAD_COUNT = 100;
+
+    if (load_level_from_image(IMAGE_PATH) && place_level_image_player(IMAGE_PATH) && save_level_file(FILE_PATH))
+    {
+        double start = get_benchmark_seconds();
+        for (int i = 0; i < LOAD_COUNT; i++)
+        {
+            load_level_from_image(IMAGE_PATH);
+        }
+        double image_time = (get_benchmark_seconds() - start) / LOAD_COUNT;
+
+        start = get_benchmark_seconds();
+        for (int i = 0; i < LOAD_COUNT; i++)
+        {
+            load_level_file(FILE_PATH);
+        }
+        double file_time = (get_benchmark_seconds() - start) / LOAD_COUNT;
+
+        printf("Loading %s: image %.1f us, level file %.1f us\n", IMAGE_PATH, image_time * 1e6, file_time * 1e6);
+    }
+
+    printf("Loading a generated cave from a level file:\n");
+    printf("%10s %22s %22s\n", "size", "file size (KB)", "time (ms)");
+
+    for (int size = 256; size <= 2048; size *= 2)
+    {
+        generate_level_cave(size, size, 1);
+        save_level_file(FILE_PATH);
+
+        auto& level = game->level;
+        std::vector<int> heights(size * size);
+        for (int i = 0; i < size * size; i++)
+        {
+            heights[i] = level.tiles[i].z;
+        }
+        int entity_count = level.entities.count;
+        clear_entities(&level.entities);
+
+        double start = get_benchmark_seconds();
+        bool loaded = load_level_file(FILE_PATH);
+        double time = get_benchmark_seconds() - start;
+
+        bool same = loaded && level.width == size && level.height == size && level.entities.count == entity_count;
+        for (int i = 0; same && i < size * size; i++)
+        {
+            same = (level.tiles[i].z == heights[i]);
+        }
+        if (!same)
+        {
+            printf("Mismatch between the %dx%d cave and the level file saved from it\n", size, size);
+            benchmark_mismatch_count++;
+        }
+
+        FILE* file = fopen(FILE_PATH, "rb");
+        fseek(file, 0, SEEK_END);
+        long file_size = ftell(file);
+        fclose(file);
+
+        char label[32];
+        snprintf(label, sizeof(label), "%dx%d", size, size);
+        printf("%10s %22.1f %22.1f\n", label, file_size / 1024.0, time * 1e3);
+    }
+    remove(FILE_PATH);
+}
+
+// Autotiling as render_tile did it before the lookup table, the neighbors of every quarter are read and
+// the piece's UVs worked out again for every tile.
+static Texture get_tile_quarter_multiply_reference(
+    int x, int y, int dx, int dy,
+    int ocx, int ocy, // outer corner
+    int icx, int icy, // inner corner
+    int fxx, int fxy, // flat X
+    int fyx, int fyy) // flat Y
+{
+    auto& level = the_game->level;
+    Tile* tile = level.tiles + y * level.width + x;
+
+    bool x_in_bounds = (x + dx >= 0) && (x + dx < level.width);
+    bool y_in_bounds = (y + dy >= 0) && (y + dy < level.height);
+    Tile* tile_x = (x_in_bounds) ? (level.tiles + y * level.width + (x + dx)) : NULL;
+    Tile* tile_y = (y_in_bounds) ? (level.tiles + (y + dy) * level.width + x) : NULL;
+    Tile* tile_c = (x_in_bounds && y_in_bounds) ? (level.tiles + (y + dy) * level.width + (x + dx)) : NULL;
+    bool empty_x = tile_x && (tile_x->z < tile->z);
+    bool empty_y = tile_y && (tile_y->z < tile->z);
+    bool empty_c = tile_c && (tile_c->z < tile->z);
+
+    if (!empty_x && !empty_y && empty_c)
+    {
+        return get_multiply_texture_piece(icx, icy);
+    }
+
+    if (empty_x || empty_y)
+    {
+        Texture full = get_multiply_texture_piece(3, 3);
+        Vector4 color = empty_x ? get_tile_color(x + dx, y) : get_tile_color(x, y + dy);
+        push_rectangle({ x + 0.25f * (dx + 1), y + 0.25f * (dy + 1) }, { 0.5f, 0.5f }, full, color);
+
+        if (empty_x && empty_y) return get_multiply_texture_piece(ocx, ocy);
+        if (empty_x) return get_multiply_texture_piece(fxx, fxy);
+        return get_multiply_texture_piece(fyx, fyy);
+    }
+
+    return get_multiply_texture_piece(3, 3);
+}
+
+static void render_tile_reference(int x, int y)
+{
+    Vector4 color = get_tile_color(x, y);
+
+    Texture multiply00 = get_tile_quarter_multiply_reference(x, y, -1, -1, 0, 1, 1, 2, 2, 1, 3, 1);
+    Texture multiply10 = get_tile_quarter_multiply_reference(x, y,  1, -1, 1, 1, 0, 2, 3, 0, 3, 1);
+    Texture multiply11 = get_tile_quarter_multiply_reference(x, y,  1,  1, 1, 0, 0, 3, 3, 0, 2, 0);
+    Texture multiply01 = get_tile_quarter_multiply_reference(x, y, -1,  1, 0, 0, 1, 3, 2, 1, 2, 0);
+
+    push_rectangle({ (float) x + 0.0f, (float) y + 0.0f }, { 0.5f, 0.5f }, multiply00, color);
+    push_rectangle({ (float) x + 0.5f, (float) y + 0.0f }, { 0.5f, 0.5f }, multiply10, color);
+    push_rectangle({ (float) x + 0.5f, (float) y + 0.5f }, { 0.5f, 0.5f }, multiply11, color);
+    push_rectangle({ (float) x + 0.0f, (float) y + 0.5f }, { 0.5f, 0.5f }, multiply01, color);
+}
+
+// Pushing every tile of a generated cave, the way a chunk bake does, with both versions. The rectangles
+// have to come out the same.
+static void benchmark_autotile(Game* game)
+{
+    game->art.multiply.uv1 = vector2(0.25f, 0.5f);
+    game->art.multiply.uv2 = vector2(0.75f, 1.0f);
+    build_autotile_table();
+
+    const int SIZE = 256;
+    generate_level_cave(SIZE, SIZE, 1);
+
+    bool was_instanced = render_instanced;
+    render_instanced = true;
+
+    render_instances.clear();
+    double start = get_benchmark_seconds();
+    for (int y = 0; y < SIZE; y++)
+    {
+        for (int x = 0; x < SIZE; x++)
+        {
+            render_tile_reference(x, y);
+        }
+    }
+    double reference_time = get_benchmark_seconds() - start;
+    std::vector<Sprite_Instance> reference = render_instances;
+
+    render_instances.clear();
+    start = get_benchmark_seconds();
+    for (int y = 0; y < SIZE; y++)
+    {
+        for (int x = 0; x < SIZE; x++)
+        {
+            render_tile(x, y);
+        }
+    }
+    double table_time = get_benchmark_seconds() - start;
+
+    start = get_benchmark_seconds();
+    tiles_changed(0, 0, SIZE - 1, SIZE - 1);
+    double update_time = get_benchmark_seconds() - start;
+
+    if (reference.size() != render_instances.size() ||
+        memcmp(reference.data(), render_instances.data(), reference.size() * sizeof(Sprite_Instance)))
+    {
+        printf("Mismatch between the reference and table autotiling\n");
+        benchmark_mismatch_count++;
+    }
+
+    printf("Autotiling %dx%d tiles: reference %.1f ns, table %.1f ns per tile, tiles_changed %.1f ns per tile\n",
+           SIZE, SIZE, reference_time * 1e9 / (SIZE * SIZE), table_time * 1e9 / (SIZE * SIZE),
+           update_time * 1e9 / (SIZE * SIZE));
+
+    render_instances.clear();
+    render_instanced = was_instanced;
+}
+
+// Not a timing: runs the persistent stream ring through allocations that end exactly on segment
+// boundaries, and checks that every allocation stays inside one segment of the ring and that segments are
+// finished in order.
+static void check_stream_ring()
+{
+    Stream_Buffer stream = {};
+    stream.size = STREAM_SEGMENT_SIZE * STREAM_SEGMENT_COUNT;
+
+    uint32 sizes[] = { STREAM_SEGMENT_SIZE / 2, STREAM_SEGMENT_SIZE / 2, STREAM_SEGMENT_SIZE, STREAM_ALIGNMENT,
+                       STREAM_SEGMENT_SIZE - STREAM_ALIGNMENT, STREAM_SEGMENT_SIZE / 4, STREAM_SEGMENT_SIZE };
+
+    int errors = 0;
+    int expected_finished = 0;
+    for (int i = 0; i < 1000; i++)
+    {
+        uint32 size = sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+        int finished = advance_stream_segment(&stream, size);
+        if (finished >= 0)
+        {
+            if (finished != expected_finished) errors++;
+            expected_finished = (expected_finished + 1) % STREAM_SEGMENT_COUNT;
+        }
+
+        uint32 offset = stream.cursor;
+        stream.cursor += size;
+
+        uint32 segment_start = stream.segment * STREAM_SEGMENT_SIZE;
+        if (stream.segment < 0 || stream.segment >= STREAM_SEGMENT_COUNT) errors++;
+        if (offset < segment_start || offset + size > segment_start + STREAM_SEGMENT_SIZE) errors++;
+        if (offset + size > stream.size) errors++;
+    }
+
+    if (errors)
+    {
+        printf("Mismatch: %d stream ring allocations outside their segment\n", errors);
+        benchmark_mismatch_count++;
+    }
+}
+
+void run_benchmarks(LK_Platform* platform)
+{
+    check_stream_ring();
+    benchmark_fireball_removal();
+    with_scratch_game(platform, benchmark_tile_collision);
+    benchmark_cave_automaton();
+    with_scratch_game(platform, benchmark_level_generation);
+    benchmark_random();
+    with_scratch_game(platform, benchmark_level_loading);
+    with_scratch_game(platform, benchmark_autotile);
+
+    if (benchmark_mismatch_count)
+    {
+        printf("%d benchmark checks failed\n", benchmark_mismatch_count);
+        exit(1);
+    }
+}
@@ -0,0 +1,87 @@
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+// One bit per cell, for questions that only need a yes or no per tile. Rows are padded to a whole number of
+// 64 bit words so a row can be worked on a word at a time, and the padding bits are always zero.
+struct Bit_Grid
+{
+    int width;
+    int height;
+    int stride; // in words
+    std::vector<uint64> words;
+};
+
+// Clears every bit.
+void resize_bit_grid(Bit_Grid* grid, int width, int height)
+{
+    grid->width = width;
+    grid->height = height;
+    grid->stride = (width + 63) / 64;
+    grid->words.assign(grid->stride * height, 0);
+}
+
+inline uint64* get_bit_row(Bit_Grid* grid, int y)
+{
+    return grid->words.data() + y * grid->stride;
+}
+
+inline bool get_bit(Bit_Grid* grid, int x, int y)
+{
+    return (grid->words[y * grid->stride + (x >> 6)] >> (x & 63)) & 1;
+}
+
+inline void set_bit(Bit_Grid* grid, int x, int y, bool value)
+{
+    uint64& word = grid->words[y * grid->stride + (x >> 6)];
+    uint64 mask = (uint64) 1 << (x & 63);
+    word = value ? (word | mask) : (word & ~mask);
+}
+
+// Index of the lowest set bit, value must not be zero.
+inline int find_lowest_bit(uint64 value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(value);
+#elif defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return (int) index;
+#else
+    int index = 0;
+    while (!(value & 1))
+    {
+        value >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+// Which bits of a row's word number word are inside the grid.
+inline uint64 get_bit_row_mask(Bit_Grid* grid, int word)
+{
+    int bits = grid->width - word * 64;
+    return (bits >= 64) ? ~(uint64) 0 : (((uint64) 1 << bits) - 1);
+}
+
+// A bit sliced number holds a small count for each of 64 cells at once, bit b of every cell's count is in
+// slices[b]. Returns the cells whose count is greater than value.
+inline uint64 sliced_greater_than(uint64* slices, int slice_count, int value)
+{
+    uint64 greater = 0;
+    uint64 equal = ~(uint64) 0;
+    for (int b = slice_count - 1; b >= 0; b--)
+    {
+        if (value & (1 << b))
+        {
+            equal &= slices[b];
+        }
+        else
+        {
+            greater |= equal & slices[b];
+            equal &= ~slices[b];
+        }
+    }
+    return greater;
+}
@@ -0,0 +1,200 @@
+// Entities are stored one array per field, an entity is an index into all of them. Every brain keeps a
+// dense list of the entities that have it, so each behavior runs as its own loop over only its entities.
+// Entity is just the description add_entity copies in.
+//
+// Removing swaps the last entity into the hole, which changes the index of the entity that was last. Code
+// that has to remember an entity across updates keeps an Entity_Handle instead. A handle names a slot, and
+// the slot's generation goes up every time it's freed, so a handle to a removed entity stops resolving
+// even after the slot is reused.
+struct Entity_Handle
+{
+    uint32 slot;
+    uint32 generation;
+};
+
+struct Entity_Storage
+{
+    int count;
+
+    std::vector<Brain> brain;
+    std::vector<Vector2> position;
+    std::vector<Vector2> previous_position; // position before the last simulation step, for interpolated rendering
+    std::vector<Vector2> velocity;
+    std::vector<Vector2> size;
+    std::vector<Texture> texture;
+    std::vector<uint8> friendly;
+    std::vector<float> health;
+    std::vector<float> max_health;
+    std::vector<float> damage;
+
+    // by_brain[b] lists every entity with brain b, brain_slot says where in that list an entity is.
+    std::vector<int> by_brain[BRAIN_COUNT];
+    std::vector<int> brain_slot;
+
+    // slot is a column like the ones above, slot_index and slot_generation are indexed by slot. Generations
+    // start at 1 so a zeroed handle never resolves.
+    std::vector<uint32> slot;
+    std::vector<int> slot_index;
+    std::vector<uint32> slot_generation;
+    std::vector<uint32> free_slots;
+
+    // Entities to remove at the end of the update, see remove_entity_later. The buffer is kept between
+    // updates so queueing doesn't allocate once it has grown.
+    std::vector<Entity_Handle> remove_queue;
+};
+
+static void free_entity_slot(Entity_Storage* entities, uint32 slot)
+{
+    entities->slot_index[slot] = -1;
+    entities->slot_generation[slot]++;
+    entities->free_slots.push_back(slot);
+}
+
+void clear_entities(Entity_Storage* entities)
+{
+    for (uint32 slot : entities->slot)
+    {
+        free_entity_slot(entities, slot);
+    }
+
+    entities->count = 0;
+    entities->brain.clear();
+    entities->position.clear();
+    entities->previous_position.clear();
+    entities->velocity.clear();
+    entities->size.clear();
+    entities->texture.clear();
+    entities->friendly.clear();
+    entities->health.clear();
+    entities->max_health.clear();
+    entities->damage.clear();
+    entities->brain_slot.clear();
+    entities->slot.clear();
+    entities->remove_queue.clear();
+    for (int brain = 0; brain < BRAIN_COUNT; brain++)
+    {
+        entities->by_brain[brain].clear();
+    }
+}
+
+Entity_Handle add_entity(Entity_Storage* entities, Entity entity)
+{
+    int index = entities->count++;
+
+    uint32 slot;
+    if (entities->free_slots.empty())
+    {
+        slot = (uint32) entities->slot_index.size();
+        entities->slot_index.push_back(-1);
+        entities->slot_generation.push_back(1);
+    }
+    else
+    {
+        slot = entities->free_slots.back();
+        entities->free_slots.pop_back();
+    }
+    entities->slot_index[slot] = index;
+    entities->slot.push_back(slot);
+
+    entities->brain.push_back(entity.brain);
+    entities->position.push_back(entity.position);
+    entities->previous_position.push_back(entity.position);
+    entities->velocity.push_back(entity.velocity);
+    entities->size.push_back(entity.size);
+    entities->texture.push_back(entity.texture);
+    entities->friendly.push_back(entity.friendly);
+    entities->health.push_back(entity.health);
+    entities->max_health.push_back(entity.max_health);
+    entities->damage.push_back(entity.damage);
+
+    std::vector<int>& list = entities->by_brain[entity.brain];
+    entities->brain_slot.push_back((int) list.size());
+    list.push_back(index);
+
+    Entity_Handle handle = { slot, entities->slot_generation[slot] };
+    return handle;
+}
+
+Entity_Handle get_entity_handle(Entity_Storage* entities, int index)
+{
+    uint32 slot = entities->slot[index];
+    Entity_Handle handle = { slot, entities->slot_generation[slot] };
+    return handle;
+}
+
+// Returns -1 when the entity has been removed.
+int get_entity_index(Entity_Storage* entities, Entity_Handle handle)
+{
+    if (handle.slot >= entities->slot_generation.size()) return -1;
+    if (entities->slot_generation[handle.slot] != handle.generation) return -1;
+    return entities->slot_index[handle.slot];
+}
+
+template <typename T>
+static void swap_remove(std::vector<T>& column, int index)
+{
+    column[index] = column.back();
+    column.pop_back();
+}
+
+void remove_entity(Entity_Storage* entities, int index)
+{
+    // Take it out of its brain list the same way, fixing up the slot of the one that moved.
+    std::vector<int>& list = entities->by_brain[entities->brain[index]];
+    int slot = entities->brain_slot[index];
+    list[slot] = list.back();
+    entities->brain_slot[list[slot]] = slot;
+    list.pop_back();
+
+    free_entity_slot(entities, entities->slot[index]);
+
+    int last = entities->count - 1;
+    if (index != last)
+    {
+        entities->by_brain[entities->brain[last]][entities->brain_slot[last]] = index;
+        entities->slot_index[entities->slot[last]] = index;
+    }
+
+    swap_remove(entities->brain, index);
+    swap_remove(entities->position, index);
+    swap_remove(entities->previous_position, index);
+    swap_remove(entities->velocity, index);
+    swap_remove(entities->size, index);
+    swap_remove(entities->texture, index);
+    swap_remove(entities->friendly, index);
+    swap_remove(entities->health, index);
+    swap_remove(entities->max_health, index);
+    swap_remove(entities->damage, index);
+    swap_remove(entities->brain_slot, index);
+    swap_remove(entities->slot, index);
+    entities->count = last;
+}
+
+// For removing entities while iterating over them. Indices stay valid until remove_queued_entities, and
+// queueing the same entity more than once is fine.
+void remove_entity_later(Entity_Storage* entities, int index)
+{
+    entities->remove_queue.push_back(get_entity_handle(entities, index));
+}
+
+// Each removal is a swap with the last entity, so the cost is linear in the number removed, not in the
+// number of entities. Handles that no longer resolve were queued twice and are skipped.
+void remove_queued_entities(Entity_Storage* entities)
+{
+    for (Entity_Handle handle : entities->remove_queue)
+    {
+        int index = get_entity_index(entities, handle);
+        if (index >= 0)
+        {
+            remove_entity(entities, index);
+        }
+    }
+    entities->remove_queue.clear();
+}
+
+// Returns -1 when there is no player.
+int find_player(Entity_Storage* entities)
+{
+    std::vector<int>& players = entities->by_brain[BRAIN_PLAYER];
+    return players.empty() ? -1 : players[0];
+}
@@ -8,10 +8,18 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <math.h>
+#include <float.h>
 
 #include <algorithm>
 #include <vector>
+#include <deque>
+#include <unordered_map>
 #include <set>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 
 constexpr float DEG2RAD = 0.01745329251;
@@ -60,13 +68,48 @@ union Matrix4
 };
 
 #include "math_ops.inl"
+#include "random.inl"
+#include "threads.inl"
+#include "spatial_grid.inl"
+#include "bit_grid.inl"
+#include "regions.inl"
 #include "renderer.inl"
+#include "software_renderer.inl"
+
+// Tiles are 0 to MAX_TILE_Z high, get_tile_color has a color for each.
+const int MAX_TILE_Z = 2;
 
 struct Tile
 {
     int z;
 };
 
+// The level is drawn in CHUNK_SIZE x CHUNK_SIZE tile blocks, each with its own baked geometry, so only
+// the chunks around the camera get drawn and a tile change only rebakes the chunks it touches.
+const int CHUNK_SIZE = 16;
+
+struct Level_Chunk
+{
+    bool dirty;
+    Static_Mesh tile_mesh;
+    Static_Mesh stone_mesh;
+};
+
+// Tiles are drawn as four quarters, each with a piece of the multiply texture that shades the edges
+// toward lower neighbors. A lower neighbor can also show through under the quarter's edge.
+enum Autotile_Underlay
+{
+    UNDERLAY_NONE,
+    UNDERLAY_X, // the neighbor left or right of the quarter
+    UNDERLAY_Y, // the neighbor below or above the quarter
+};
+
+struct Autotile_Quarter
+{
+    uint8 piece; // x + 4 * y in the 4x4 grid of multiply pieces
+    uint8 underlay;
+};
+
 struct Note
 {
     int lane;
@@ -87,6 +130,8 @@ enum Brain
     BRAIN_TREASURE,
     BRAIN_MONSTER,
     BRAIN_FIREBALL,
+
+    BRAIN_COUNT,
 };
 
 struct Entity
@@ -102,6 +147,8 @@ struct Entity
     float damage;
 };
 
+#include "entities.inl"
+
 enum Game_State
 {
     GAME_ROGUE,
@@ -117,6 +164,30 @@ enum Combat_State
     COMBAT_ACTOR_FLEE,
 };
 
+// The level is simulated in fixed steps, rendering interpolates between the last two. After a long hitch
+// the leftover time is dropped instead of catching up, so one slow frame doesn't cause a run of slower
+// ones.
+const float SIMULATION_STEP = 1.0f / 120.0f;
+const int MAX_SIMULATION_STEPS_PER_FRAME = 8;
+
+// A CHUNK_SIZE x CHUNK_SIZE piece of the streaming world, see world.inl. Treasure and monster positions are
+// relative to the chunk's corner.
+struct World_Chunk
+{
+    int chunk_x;
+    int chunk_y;
+    int world_id;
+    uint64 seed;
+
+    // Set on the main thread once generation is done, nothing else is touched while it's being generated.
+    bool ready;
+    uint64 last_used;
+
+    uint8 tiles[CHUNK_SIZE * CHUNK_SIZE];
+    std::vector<Vector2> treasure;
+    std::vector<Vector2> monsters;
+};
+
 struct Game
 {
     bool initialized;
@@ -126,6 +197,28 @@ struct Game
 
     Renderer renderer;
 
+    // For everything not tied to a level, including picking level seeds. Seeded with LD41_SEED if it's set.
+    Random random;
+
+    // Set by LD41_LEVEL, levels are loaded from this level file instead of generated.
+    const char* level_path;
+
+    // Set by LD41_DUMP_FRAME or LD41_CHECK_FRAME, both <frame>:<path> with frames counted from 1. That frame
+    // is saved to the path, or compared with the frame saved there, and then the game quits. A frame that
+    // doesn't match exits with 1. The reference frame is checked on Linux, after ./build.sh, from run_tree with
+    //
+    //     LD41_SEED=2 LD41_FIXED_LEVEL=1 LD41_STEPS_PER_FRAME=1 LD41_CHECK_FRAME=120:data/reference/frame.tga ./ld41
+    //
+    // and rewritten by the same command with LD41_DUMP_FRAME. The level, the fixed steps and the software
+    // renderer don't depend on the clock, so every run renders the same frame.
+    struct
+    {
+        int frame;
+        const char* path;
+        bool check;
+        int frame_count;
+    } capture;
+
     struct
     {
         Texture marker;
@@ -144,6 +237,14 @@ struct Game
         LK_Wave snare;
     } sounds;
 
+    // Built once by build_autotile_table. quarters is indexed by a tile's neighbor mask, see
+    // get_autotile_mask.
+    struct
+    {
+        Texture pieces[16];
+        Autotile_Quarter quarters[256][4];
+    } autotile;
+
     struct
     {
         float time;
@@ -161,17 +262,63 @@ struct Game
         int height;
         Tile* tiles;
 
-        std::vector<Entity> entities;
+        // Which tiles are solid, and the neighbor mask of every tile for autotiling, kept in sync with
+        // tiles by tiles_changed.
+        Bit_Grid solid;
+        std::vector<uint8> autotile;
+
+        Entity_Storage entities;
+
+        // Entity indices bucketed by position, rebuilt at the start of every update_level.
+        Spatial_Grid grid;
+        std::vector<int> query_results;
+
+        // For the monsters, seeded by the level seed.
+        Random random;
+        std::vector<float> monster_rolls;
+
+        // Geometry derived from tiles, rebuilt by render_level after tiles_changed.
+        int chunks_x;
+        int chunks_y;
+        std::vector<Level_Chunk> chunks;
 
         float camera_height = 16;
         Vector2 camera_position;
+        Vector2 previous_camera_position;
         Vector2 target_camera_position;
     } level;
 
     struct
     {
-        Entity* actor;
-        Entity* other;
+        // Off when LD41_FIXED_LEVEL is set, then levels are single generate_level_cave caves.
+        bool enabled;
+        int id;
+        uint64 seed;
+        uint64 frame;
+
+        // The world chunk at the level's corner, and which of the SPAWNED_ flags each chunk of the window
+        // has.
+        int origin_x;
+        int origin_y;
+        std::vector<uint8> spawned;
+
+        std::unordered_map<uint64, World_Chunk*> chunks;
+    } world;
+
+    struct
+    {
+        float accumulator;
+        float alpha;
+
+        // When set, every frame runs exactly this many steps regardless of wall clock time, which lets
+        // a headless run simulate faster than real time.
+        int steps_per_frame;
+    } simulation;
+
+    struct
+    {
+        Entity_Handle actor;
+        Entity_Handle other;
 
         Combat_State state;
         float state_time;
@@ -187,12 +334,122 @@ struct Game
 
 static Game* the_game;
 
-void load_level_from_image(const char* path)
+// Bit of a neighbor in an autotile mask, the 8 neighbors in row order with the tile itself left out.
+inline int get_autotile_bit(int dx, int dy)
+{
+    int index = (dy + 1) * 3 + (dx + 1);
+    return (index < 4) ? index : index - 1;
+}
+
+// Which neighbors are lower than the tile. Outside the level counts as the same height.
+static uint8 get_autotile_mask(int x, int y)
+{
+    auto& level = the_game->level;
+    Tile* tile = level.tiles + y * level.width + x;
+    int z = tile->z;
+
+    // Away from the edges every neighbor exists, the bits are in get_autotile_bit order.
+    if (x > 0 && x < level.width - 1 && y > 0 && y < level.height - 1)
+    {
+        int w = level.width;
+        return (tile[-w - 1].z < z) << 0 | (tile[-w].z < z) << 1 | (tile[-w + 1].z < z) << 2 |
+               (tile[-1].z     < z) << 3 |                         (tile[1].z      < z) << 4 |
+               (tile[w - 1].z  < z) << 5 | (tile[w].z  < z) << 6 | (tile[w + 1].z  < z) << 7;
+    }
+
+    uint8 mask = 0;
+    for (int dy = -1; dy <= 1; dy++)
+    {
+        for (int dx = -1; dx <= 1; dx++)
+        {
+            int neighbor_x = x + dx;
+            int neighbor_y = y + dy;
+            if (neighbor_x < 0 || neighbor_x >= level.width)  continue;
+            if (neighbor_y < 0 || neighbor_y >= level.height) continue;
+            if ((dx || dy) && level.tiles[neighbor_y * level.width + neighbor_x].z < z)
+            {
+                mask |= 1 << get_autotile_bit(dx, dy);
+            }
+        }
+    }
+    return mask;
+}
+
+// Has to be called whenever level.tiles is modified, the bounds are inclusive tile coordinates.
+void tiles_changed(int min_x, int min_y, int max_x, int max_y)
+{
+    auto& level = the_game->level;
+
+    int chunks_x = (level.width  + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    int chunks_y = (level.height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    if (chunks_x != level.chunks_x || chunks_y != level.chunks_y)
+    {
+        for (Level_Chunk& chunk : level.chunks)
+        {
+            free_mesh(&the_game->renderer, &chunk.tile_mesh);
+            free_mesh(&the_game->renderer, &chunk.stone_mesh);
+        }
+
+        level.chunks_x = chunks_x;
+        level.chunks_y = chunks_y;
+        level.chunks.assign(chunks_x * chunks_y, {});
+    }
+
+    // Autotiling looks at the neighbors, so the geometry of the tiles around the change is affected too.
+    int min_chunk_x = max_i32(min_x - 1, 0) / CHUNK_SIZE;
+    int min_chunk_y = max_i32(min_y - 1, 0) / CHUNK_SIZE;
+    int max_chunk_x = min_i32(max_x + 1, level.width  - 1) / CHUNK_SIZE;
+    int max_chunk_y = min_i32(max_y + 1, level.height - 1) / CHUNK_SIZE;
+
+    for (int chunk_y = min_chunk_y; chunk_y <= max_chunk_y; chunk_y++)
+    {
+        for (int chunk_x = min_chunk_x; chunk_x <= max_chunk_x; chunk_x++)
+        {
+            level.chunks[chunk_y * level.chunks_x + chunk_x].dirty = true;
+        }
+    }
+
+    if (level.solid.width != level.width || level.solid.height != level.height)
+    {
+        resize_bit_grid(&level.solid, level.width, level.height);
+    }
+
+    for (int y = min_y; y <= max_y; y++)
+    {
+        for (int x = min_x; x <= max_x; x++)
+        {
+            set_bit(&level.solid, x, y, level.tiles[y * level.width + x].z != 0);
+        }
+    }
+
+    if ((int) level.autotile.size() != level.width * level.height)
+    {
+        level.autotile.assign(level.width * level.height, 0);
+    }
+
+    for (int y = max_i32(min_y - 1, 0); y <= min_i32(max_y + 1, level.height - 1); y++)
+    {
+        for (int x = max_i32(min_x - 1, 0); x <= min_i32(max_x + 1, level.width - 1); x++)
+        {
+            level.autotile[y * level.width + x] = get_autotile_mask(x, y);
+        }
+    }
+
+    // A shadow texel at (x, y) depends on the tiles (x - 1 .. x, y - 1 .. y).
+    mark_shadow_map_dirty(&the_game->renderer.shadow_map, min_x, min_y, max_x + 1, max_y + 1);
+}
+
+bool load_level_from_image(const char* path)
 {
     int width;
     int height;
     int dont_care;
     uint8* pixels = stbi_load(path, &width, &height, &dont_care, 4);
+    if (!pixels)
+    {
+        printf("Failed to load level %s\n", path);
+        return false;
+    }
 
     auto& level = the_game->level;
     level.width = width;
@@ -217,16 +474,9 @@ void load_level_from_image(const char* path)
     }
 
     stbi_image_free(pixels);
-}
 
-int random_int(int max)
-{
-    return rand() % max;
-}
-
-float random_float()
-{
-    return (float) rand() / (float) RAND_MAX;
+    tiles_changed(0, 0, level.width - 1, level.height - 1);
+    return true;
 }
 
 void render_string(const char* text, float x, float y, float sx, float sy, Vector4 color = { 1, 1, 1, 1 })
@@ -274,193 +524,323 @@ void render_centered_string(const char* text, float x, float y, float sx, float
 
 #include "rhythm.inl"
 
-static int generator_count_neighbors(Tile* read, int width, int height, int x, int y)
+// The generator works on whole 64 cell words of a Bit_Grid. Cells outside the level count as solid, so
+// words beyond the edges read as solid, and the padding bit just past the end of a row stands in for the
+// cell to the right of it.
+static uint64 generator_load_word(Bit_Grid* read, int y, int word)
+{
+    if (y < 0 || y >= read->height) return ~(uint64) 0;
+    if (word < 0) return (uint64) 1 << 63;
+    if (word >= read->stride) return 1;
+
+    uint64 value = read->words[y * read->stride + word];
+    int end = read->width - word * 64;
+    if (end < 64)
+    {
+        value |= (uint64) 1 << end;
+    }
+    return value;
+}
+
+static void full_add(uint64 a, uint64 b, uint64 c, uint64* sum, uint64* carry)
 {
-    int count = 0;
+    *sum = a ^ b ^ c;
+    *carry = (a & b) | (c & (a ^ b));
+}
 
+// Counts the solid cells in the 3x3 block around each cell of a word of row y, the cell itself included.
+// The counts come out bit sliced in count[0..3], see sliced_greater_than.
+static void generator_count_neighbors(Bit_Grid* read, int y, int word, uint64* count)
+{
+    uint64 bits[9];
     for (int dy = -1; dy <= 1; dy++)
     {
-        for (int dx = -1; dx <= 1; dx++)
-        {
-            int nx = x + dx;
-            int ny = y + dy;
-            if (nx < 0 || ny < 0 || nx >= width || ny >= height)
-            {
-                count++;
-            }
-            else
-            {
-                count += read[ny * width + nx].z;
-            }
-        }
+        uint64 previous = generator_load_word(read, y + dy, word - 1);
+        uint64 current  = generator_load_word(read, y + dy, word);
+        uint64 next     = generator_load_word(read, y + dy, word + 1);
+
+        uint64* row = bits + (dy + 1) * 3;
+        row[0] = (current << 1) | (previous >> 63);
+        row[1] = current;
+        row[2] = (current >> 1) | (next << 63);
     }
 
-    return count;
+    uint64 sum_a, sum_b, sum_c;
+    uint64 carry_a, carry_b, carry_c, carry_d;
+    full_add(bits[0], bits[1], bits[2], &sum_a, &carry_a);
+    full_add(bits[3], bits[4], bits[5], &sum_b, &carry_b);
+    full_add(bits[6], bits[7], bits[8], &sum_c, &carry_c);
+    full_add(sum_a, sum_b, sum_c, &count[0], &carry_d);
+
+    uint64 twos, fours;
+    full_add(carry_a, carry_b, carry_c, &twos, &fours);
+    count[1] = twos ^ carry_d;
+    uint64 carry = twos & carry_d;
+    count[2] = fours ^ carry;
+    count[3] = fours & carry;
 }
 
-void generate_level_cave(int width, int height)
+// One iteration of the birth and death automaton for rows first_row up to end_row, a solid cell stays solid
+// with more than death_limit solid cells around it and an open cell becomes solid with more than
+// birth_limit. Only write changes, so the rows around the range are read straight from read and bands
+// of rows can be stepped at the same time.
+static void generator_step(Bit_Grid* read, Bit_Grid* write, int first_row, int end_row, int birth_limit, int death_limit)
 {
-    auto& level = the_game->level;
-    level.width = width;
-    level.height = height;
-    if (level.tiles)
+    for (int y = first_row; y < end_row; y++)
     {
-        delete[] level.tiles;
+        uint64* read_row  = get_bit_row(read, y);
+        uint64* write_row = get_bit_row(write, y);
+        for (int word = 0; word < read->stride; word++)
+        {
+            uint64 count[4];
+            generator_count_neighbors(read, y, word, count);
+
+            uint64 solid = read_row[word];
+            uint64 survive = sliced_greater_than(count, 4, death_limit);
+            uint64 born = sliced_greater_than(count, 4, birth_limit);
+            write_row[word] = ((solid & survive) | (~solid & born)) & get_bit_row_mask(read, word);
+        }
     }
+}
 
-    level.entities.clear();
+// Caves start out as random noise and are smoothed by a few iterations of the automaton in generator_step.
+// Treasure goes in open cells with at least CAVE_TREASURE_LIMIT solid cells around them, and there is a
+// monster for every CAVE_CELLS_PER_MONSTER spawn cells the player can reach.
+const float CAVE_INITIAL_CHANCE = 0.4;
+const int CAVE_BIRTH_LIMIT = 4;
+const int CAVE_DEATH_LIMIT = 3;
+const int CAVE_ITERATION_COUNT = 5;
+const int CAVE_TREASURE_LIMIT = 4;
+const float CAVE_TREASURE_CHANCE = 0.4;
+const int CAVE_CELLS_PER_MONSTER = 50;
+
+// Generation is split into bands of rows that run on the worker threads. Every band draws from its own
+// random stream, picked by the level seed and the band, so a level only depends on its seed and never on
+// how many threads made it.
+const int GENERATOR_BAND_HEIGHT = 16;
+
+enum Generator_Stream
+{
+    GENERATOR_STREAM_SEED,
+    GENERATOR_STREAM_TREASURE,
+    GENERATOR_STREAM_PLACEMENT,
+    GENERATOR_STREAM_MONSTERS,
+};
 
-    Tile* read  = new Tile[width * height];
-    Tile* write = new Tile[width * height];
+static Random generator_random(uint64 seed, Generator_Stream stream, int band)
+{
+    return seed_random(seed, ((uint64) stream << 32) | (uint32) band);
+}
 
-    const float initial_chance = 0.4;
-    const int birth_limit = 4;
-    const int death_limit = 3;
-    const int iteration_count = 5;
+struct Generator_Job
+{
+    uint64 seed;
+    Bit_Grid* read;
+    Bit_Grid* write;
+    std::vector<std::vector<Vector2>> treasure_positions; // one list per band
+};
 
-    const int treasure_limit = 4;
-    const float treasure_chance = 0.4;
+static void get_generator_band(Bit_Grid* grid, int band, int* first_row, int* end_row)
+{
+    *first_row = band * GENERATOR_BAND_HEIGHT;
+    *end_row = min_i32(*first_row + GENERATOR_BAND_HEIGHT, grid->height);
+}
 
-    // random seed
+static void generator_seed_band(void* data, int band)
+{
+    Generator_Job* job = (Generator_Job*) data;
+    Random random = generator_random(job->seed, GENERATOR_STREAM_SEED, band);
 
-    for (int y = 0; y < height; y++)
+    int first_row, end_row;
+    get_generator_band(job->write, band, &first_row, &end_row);
+    for (int y = first_row; y < end_row; y++)
     {
-        for (int x = 0; x < width; x++)
+        for (int x = 0; x < job->write->width; x++)
         {
-            float roll = random_float();
-            write[y * width + x].z = (int)(roll < initial_chance);
+            float roll = random_float(&random);
+            set_bit(job->write, x, y, roll < CAVE_INITIAL_CHANCE);
         }
     }
+}
 
-    // cellular automata
+static void generator_step_band(void* data, int band)
+{
+    Generator_Job* job = (Generator_Job*) data;
 
-    for (int step = 0; step < iteration_count; step++)
-    {
-        std::swap(read, write);
+    int first_row, end_row;
+    get_generator_band(job->write, band, &first_row, &end_row);
+    generator_step(job->read, job->write, first_row, end_row, CAVE_BIRTH_LIMIT, CAVE_DEATH_LIMIT);
+}
 
-        for (int y = 0; y < height; y++)
+// Treasure goes in open cells with enough solid cells around them. The positions are collected per band
+// and turned into entities afterwards, in band order.
+static void generator_treasure_band(void* data, int band)
+{
+    Generator_Job* job = (Generator_Job*) data;
+    Bit_Grid* grid = job->write;
+    Random random = generator_random(job->seed, GENERATOR_STREAM_TREASURE, band);
+    std::vector<Vector2>& positions = job->treasure_positions[band];
+
+    int first_row, end_row;
+    get_generator_band(grid, band, &first_row, &end_row);
+    for (int y = first_row; y < end_row; y++)
+    {
+        uint64* row = get_bit_row(grid, y);
+        for (int word = 0; word < grid->stride; word++)
         {
-            for (int x = 0; x < width; x++)
+            uint64 count[4];
+            generator_count_neighbors(grid, y, word, count);
+
+            // Visited lowest bit first, so the rolls happen in the same order as a loop over x.
+            uint64 candidates = ~row[word] & sliced_greater_than(count, 4, CAVE_TREASURE_LIMIT - 1) & get_bit_row_mask(grid, word);
+            while (candidates)
             {
-                int count = generator_count_neighbors(read, width, height, x, y);
+                int x = word * 64 + find_lowest_bit(candidates);
+                candidates &= candidates - 1;
 
-                if (read[y * width + x].z)
-                {
-                    write[y * width + x].z = (int)(count > death_limit);
-                }
-                else
+                float roll = random_float(&random);
+                if (roll > CAVE_TREASURE_CHANCE)
                 {
-                    write[y * width + x].z = (int)(count > birth_limit);
+                    continue;
                 }
+
+                positions.push_back(vector2(x + 0.5, y + 0.5));
             }
         }
     }
+}
 
-    // treasure
-
-    for (int y = 0; y < height; y++)
+void generate_level_cave(int width, int height, uint64 seed)
+{
+    auto& level = the_game->level;
+    level.width = width;
+    level.height = height;
+    if (level.tiles)
     {
-        for (int x = 0; x < width; x++)
-        {
-            if (!write[y * width + x].z)
-            {
-                int count = generator_count_neighbors(write, width, height, x, y);
-                if (count >= treasure_limit)
-                {
-                    float roll = random_float();
-                    if (roll > treasure_chance)
-                    {
-                        continue;
-                    }
+        delete[] level.tiles;
+    }
 
-                    Entity treasure;
-                    treasure.brain = BRAIN_TREASURE;
-                    treasure.position = vector2(x + 0.5, y + 0.5);
-                    treasure.size = vector2(1, 1);
-                    treasure.texture = the_game->art.barrel;
-                    level.entities.push_back(treasure);
-                }
-            }
-        }
+    clear_entities(&level.entities);
+
+    Bit_Grid read = {};
+    Bit_Grid write = {};
+    resize_bit_grid(&read,  width, height);
+    resize_bit_grid(&write, width, height);
+
+    Generator_Job job = {};
+    job.seed = seed;
+    job.read = &read;
+    job.write = &write;
+
+    int band_count = (height + GENERATOR_BAND_HEIGHT - 1) / GENERATOR_BAND_HEIGHT;
+
+    // random seed
+
+    parallel_for(band_count, generator_seed_band, &job);
+
+    // cellular automata
+
+    for (int step = 0; step < CAVE_ITERATION_COUNT; step++)
+    {
+        std::swap(read, write);
+        parallel_for(band_count, generator_step_band, &job);
     }
 
-    /*
-    // find columns
+    // treasure
 
-    for (int y = 0; y < height - 3; y++)
+    job.treasure_positions.resize(band_count);
+    parallel_for(band_count, generator_treasure_band, &job);
+
+    for (std::vector<Vector2>& positions : job.treasure_positions)
     {
-        for (int x = 0; x < width - 3; x++)
+        for (Vector2 position : positions)
         {
-            if (write[(y + 0) * width + (x + 1)].z != 0) continue;
-            if (write[(y + 0) * width + (x + 2)].z != 0) continue;
-            if (write[(y + 1) * width + (x + 0)].z != 0) continue;
-            if (write[(y + 1) * width + (x + 1)].z != 1) continue;
-            if (write[(y + 1) * width + (x + 2)].z != 1) continue;
-            if (write[(y + 1) * width + (x + 3)].z != 0) continue;
-            if (write[(y + 2) * width + (x + 0)].z != 0) continue;
-            if (write[(y + 2) * width + (x + 1)].z != 1) continue;
-            if (write[(y + 2) * width + (x + 2)].z != 1) continue;
-            if (write[(y + 2) * width + (x + 3)].z != 0) continue;
-            if (write[(y + 3) * width + (x + 1)].z != 0) continue;
-            if (write[(y + 3) * width + (x + 2)].z != 0) continue;
-
-            write[(y + 1) * width + (x + 1)].z = 2;
-            write[(y + 1) * width + (x + 2)].z = 2;
-            write[(y + 2) * width + (x + 1)].z = 2;
-            write[(y + 2) * width + (x + 2)].z = 2;
+            Entity treasure;
+            treasure.brain = BRAIN_TREASURE;
+            treasure.position = position;
+            treasure.size = vector2(1, 1);
+            treasure.texture = the_game->art.barrel;
+            add_entity(&level.entities, treasure);
         }
     }
-    */
 
-    // place the player
+    level.random = generator_random(seed, GENERATOR_STREAM_MONSTERS, 0);
 
-    while (true)
-    {
-        int x = random_int(width - 1);
-        int y = random_int(height - 1);
+    // place the player and monsters, all in the largest region so everything can reach the player
 
-        if (read[(y + 0) * width + (x + 0)].z) continue;
-        if (read[(y + 0) * width + (x + 1)].z) continue;
-        if (read[(y + 1) * width + (x + 1)].z) continue;
-        if (read[(y + 1) * width + (x + 0)].z) continue;
+    Spawn_Regions regions = {};
+    find_spawn_regions(&write, &regions);
+    int region = find_largest_region(&regions);
 
+    Random random = generator_random(seed, GENERATOR_STREAM_PLACEMENT, 0);
+    if (region >= 0)
+    {
         Entity player = {};
         player.brain = BRAIN_PLAYER;
         player.size = vector2(1.7, 1.7);
-        player.position = vector2(x + 1, y + 1) - 0.5 * player.size;
+        player.position = get_random_spawn_position(&regions, region, &random) - 0.5 * player.size;
         player.texture = the_game->art.white;
         player.health = 10;
         player.max_health = 10;
-        level.entities.push_back(player);
-        break;
-    }
+        add_entity(&level.entities, player);
 
-    // place monsters
+        int monster_count = get_region_size(&regions, region) / CAVE_CELLS_PER_MONSTER;
+        for (int i = 0; i < monster_count; i++)
+        {
+            Entity monster = {};
+            monster.brain = BRAIN_MONSTER;
+            monster.size = vector2(1.2, 1.2);
+            monster.position = get_random_spawn_position(&regions, region, &random) - 0.5 * monster.size;
+            monster.texture = the_game->art.white;
+            monster.health = 5;
+            monster.max_health = 5;
+            add_entity(&level.entities, monster);
+        }
+    }
 
-    for (int i = 0; i < 80; i++)
+    level.tiles = new Tile[width * height];
+    for (int y = 0; y < height; y++)
     {
-        int x = random_int(width - 1);
-        int y = random_int(height - 1);
+        for (int x = 0; x < width; x++)
+        {
+            level.tiles[y * width + x].z = get_bit(&write, x, y);
+        }
+    }
 
-        if (read[(y + 0) * width + (x + 0)].z) continue;
-        if (read[(y + 0) * width + (x + 1)].z) continue;
-        if (read[(y + 1) * width + (x + 1)].z) continue;
-        if (read[(y + 1) * width + (x + 0)].z) continue;
+    /*
+    // find columns
 
-        Entity monster = {};
-        monster.brain = BRAIN_MONSTER;
-        monster.size = vector2(1.2, 1.2);
-        monster.position = vector2(x + 1, y + 1) - 0.5 * monster.size;
-        monster.texture = the_game->art.white;
-        monster.health = 5;
-        monster.max_health = 5;
-        level.entities.push_back(monster);
+    for (int y = 0; y < height - 3; y++)
+    {
+        for (int x = 0; x < width - 3; x++)
+        {
+            if (level.tiles[(y + 0) * width + (x + 1)].z != 0) continue;
+            if (level.tiles[(y + 0) * width + (x + 2)].z != 0) continue;
+            if (level.tiles[(y + 1) * width + (x + 0)].z != 0) continue;
+            if (level.tiles[(y + 1) * width + (x + 1)].z != 1) continue;
+            if (level.tiles[(y + 1) * width + (x + 2)].z != 1) continue;
+            if (level.tiles[(y + 1) * width + (x + 3)].z != 0) continue;
+            if (level.tiles[(y + 2) * width + (x + 0)].z != 0) continue;
+            if (level.tiles[(y + 2) * width + (x + 1)].z != 1) continue;
+            if (level.tiles[(y + 2) * width + (x + 2)].z != 1) continue;
+            if (level.tiles[(y + 2) * width + (x + 3)].z != 0) continue;
+            if (level.tiles[(y + 3) * width + (x + 1)].z != 0) continue;
+            if (level.tiles[(y + 3) * width + (x + 2)].z != 0) continue;
+
+            level.tiles[(y + 1) * width + (x + 1)].z = 2;
+            level.tiles[(y + 1) * width + (x + 2)].z = 2;
+            level.tiles[(y + 2) * width + (x + 1)].z = 2;
+            level.tiles[(y + 2) * width + (x + 2)].z = 2;
+        }
     }
+    */
 
-    level.tiles = write;
-    delete[] read;
+    tiles_changed(0, 0, width - 1, height - 1);
 }
 
+#include "world.inl"
+#include "level_file.inl"
+
 static bool intersect_aabb_aabb(Vector2 center1, Vector2 size1, Vector2 center2, Vector2 size2)
 {
     size1 *= 0.5f;
@@ -473,288 +853,368 @@ static bool intersect_aabb_aabb(Vector2 center1, Vector2 size1, Vector2 center2,
            (max1.y > min2.y) && (min1.y < max2.y);
 }
 
-static float collide_aabb_aabb_axis(float center1, float size1, float center2, float size2)
+// Entities stop this far short of a wall, so a box resting against one doesn't count as overlapping it.
+const float COLLISION_SKIN = 1e-3f;
+
+static bool is_tile_solid(int x, int y)
 {
-    if (center1 < center2)
-    {
-        float my_right = center1 + size1 * 0.5;
-        float their_left = center2 - size2 * 0.5;
-        return their_left - my_right;
-    }
-    else
-    {
-        float my_left = center1 - size1 * 0.5;
-        float their_right = center2 + size2 * 0.5;
-        return their_right - my_left;
-    }
+    return get_bit(&the_game->level.solid, x, y);
 }
 
-static Vector2 collide_aabb_aabb(Vector2 center1, Vector2 size1, Vector2 center2, Vector2 size2)
+// Moves the box along one axis until its leading edge touches a solid tile, looking only at the tiles
+// between where the edge starts and where it would end up. Tiles the box already overlaps don't block,
+// so something that ends up inside a wall can still walk out of it. Outside the level nothing is solid.
+static float sweep_axis(Vector2 position, Vector2 size, float delta, int axis)
 {
-    if (!intersect_aabb_aabb(center1, size1, center2, size2))
-    {
-        return center1;
-    }
+    auto& level = the_game->level;
+
+    float start = position.e[axis];
+    if (delta == 0) return start;
 
-    float x_axis = collide_aabb_aabb_axis(center1.x, size1.x, center2.x, size2.x);
-    float y_axis = collide_aabb_aabb_axis(center1.y, size1.y, center2.y, size2.y);
+    int cross = 1 - axis;
+    int along_count = axis ? level.height : level.width;
+    int cross_count = axis ? level.width  : level.height;
 
-    if (fabs(x_axis) < fabs(y_axis))
+    float half_size = size.e[axis] * 0.5f;
+    float cross_min = position.e[cross] - size.e[cross] * 0.5f;
+    float cross_max = position.e[cross] + size.e[cross] * 0.5f;
+    int first_cross = max_i32((int) floorf(cross_min), 0);
+    int last_cross  = min_i32((int) ceilf (cross_max) - 1, cross_count - 1);
+
+    if (delta > 0)
     {
-        center1.x += x_axis;
+        float edge = start + half_size;
+        int first = max_i32((int) ceilf(edge - COLLISION_SKIN), 0);
+        int last  = min_i32((int) ceilf(edge + delta) - 1, along_count - 1);
+        for (int line = first; line <= last; line++)
+        {
+            for (int other = first_cross; other <= last_cross; other++)
+            {
+                bool solid = axis ? is_tile_solid(other, line) : is_tile_solid(line, other);
+                if (solid)
+                {
+                    return max_f32(start, line - COLLISION_SKIN - half_size);
+                }
+            }
+        }
     }
     else
     {
-        center1.y += y_axis;
+        float edge = start - half_size;
+        int first = min_i32((int) floorf(edge + COLLISION_SKIN) - 1, along_count - 1);
+        int last  = max_i32((int) floorf(edge + delta), 0);
+        for (int line = first; line >= last; line--)
+        {
+            for (int other = first_cross; other <= last_cross; other++)
+            {
+                bool solid = axis ? is_tile_solid(other, line) : is_tile_solid(line, other);
+                if (solid)
+                {
+                    return min_f32(start, line + 1 + COLLISION_SKIN + half_size);
+                }
+            }
+        }
     }
 
-    return center1;
+    return start + delta;
+}
+
+// Resolves the whole move in one pass, x first and then y, so a box slides along walls and can't pass
+// through a corner however far it moves.
+static Vector2 move_entity(Vector2 position, Vector2 size, Vector2 delta)
+{
+    position.x = sweep_axis(position, size, delta.x, 0);
+    position.y = sweep_axis(position, size, delta.y, 1);
+    return position;
 }
 
-static void move_entity(Entity* entity, Vector2 delta)
+void update_level(float delta_time)
 {
     auto& level = the_game->level;
+    auto& platform = *the_game->platform;
+    auto& entities = level.entities;
 
-    const float MAX_MOVE_DISTANCE = 0.1;
-    float distance = length(delta);
-    if (distance > MAX_MOVE_DISTANCE)
+    clear_spatial_grid(&level.grid, level.width, level.height);
+    for (int entity_index = 0; entity_index < entities.count; entity_index++)
     {
-        Vector2 my_delta = noz(delta) * MAX_MOVE_DISTANCE;
-        move_entity(entity, delta - my_delta);
-
-        distance = MAX_MOVE_DISTANCE;
-        delta = my_delta;
+        add_to_spatial_grid(&level.grid, entity_index, entities.position[entity_index], entities.size[entity_index]);
     }
+    build_spatial_grid(&level.grid);
 
-    entity->position += delta;
-    Vector2 min_extreme = entity->position - entity->size * 0.5;
-    Vector2 max_extreme = entity->position + entity->size * 0.5;
-
-    int min_x = max_i32((int)(floorf(min_extreme.x) + 0.5f), 0);
-    int min_y = max_i32((int)(floorf(min_extreme.y) + 0.5f), 0);
-    int max_x = min_i32((int)(ceilf (max_extreme.x) + 0.5f), level.width  - 1);
-    int max_y = min_i32((int)(ceilf (max_extreme.y) + 0.5f), level.height - 1);
+    int player = find_player(&entities);
 
-    for (int y = min_y; y <= max_y; y++)
+    // Entities added during the loops land past the counts taken here and don't update until the next
+    // step. Adding can reallocate the columns, so nothing holds a reference into them across an add.
+    std::vector<int>& players = entities.by_brain[BRAIN_PLAYER];
+    int player_count = (int) players.size();
+    for (int i = 0; i < player_count; i++)
     {
-        for (int x = min_x; x <= max_x; x++)
+        int entity_index = players[i];
+        auto& keyboard = platform.keyboard;
+        Vector2 size = entities.size[entity_index];
+
+        Vector2 move = {};
+        if (keyboard.state['D'].down) move.x += 1;
+        if (keyboard.state['A'].down) move.x -= 1;
+        if (keyboard.state['W'].down) move.y += 1;
+        if (keyboard.state['S'].down) move.y -= 1;
+
+        float move_distance = 6 * delta_time;
+        Vector2 position = move_entity(entities.position[entity_index], size, noz(move) * move_distance);
+        entities.position[entity_index] = position;
+        level.target_camera_position = position;
+
+        query_aabb(&level.grid, position, size, &level.query_results);
+        for (int other_index : level.query_results)
         {
-            Tile* tile = level.tiles + y * level.width + x;
-            if (!tile->z) continue;
-
-            Vector2 tile_center = vector2(x + 0.5f, y + 0.5f);
-            Vector2 tile_size = { 1, 1 };
+            if (other_index == entity_index) continue;
+            if (entities.brain[other_index] != BRAIN_MONSTER) continue;
+            if (!intersect_aabb_aabb(position, size, entities.position[other_index], entities.size[other_index]))
+            {
+                continue;
+            }
 
-            Vector2 old_position = entity->position;
-            Vector2 new_position = collide_aabb_aabb(old_position, entity->size, tile_center, tile_size);
-            entity->position = new_position;
+            the_game->state = GAME_COMBAT;
+            the_game->combat.actor = get_entity_handle(&entities, entity_index);
+            the_game->combat.other = get_entity_handle(&entities, other_index);
+            break;
         }
-    }
-}
 
-Entity* find_player()
-{
-    auto& level = the_game->level;
-
-    for (Entity& entity : level.entities)
-    {
-        if (entity.brain == BRAIN_PLAYER)
+        /*
+        if (platform.mouse.left_button.pressed)
         {
-            return &entity;
+            float mx =     platform.mouse.x / (float) platform.window.width;
+            float my = 1 - platform.mouse.y / (float) platform.window.height;
+
+            float aspect = (float) platform.window.width / (float) platform.window.height;
+            float wx = level.camera_position.x + (mx - 0.5f) * level.camera_height * aspect;
+            float wy = level.camera_position.y + (my - 0.5f) * level.camera_height;
+
+            Entity fireball = {};
+            fireball.brain = BRAIN_FIREBALL;
+            fireball.size = { 1, 1 };
+            fireball.position = position;
+            fireball.velocity = noz(vector2(wx, wy) - fireball.position) * 10;
+            fireball.texture = the_game->art.white;
+            fireball.friendly = true;
+            fireball.damage = 1;
+            add_entity(&entities, fireball);
         }
+        */
     }
 
-    return NULL;
-}
+    std::vector<int>& monsters = entities.by_brain[BRAIN_MONSTER];
+    int monster_count = (int) monsters.size();
+    // Every monster gets one roll per step, wandering ones draw their target as they go.
+    level.monster_rolls.resize(monster_count);
+    random_floats(&level.random, level.monster_rolls.data(), monster_count);
 
-void update_level(float delta_time)
-{
-    auto& level = the_game->level;
-    auto& platform = *the_game->platform;
-
-    std::set<int> erase_after_update;
-
-    if (platform.keyboard.state[LK_KEY_SPACE].pressed)
+    for (int i = 0; i < monster_count; i++)
     {
-        generate_level_cave(64, 64);
-    }
-
-    for (int entity_index = 0; entity_index < level.entities.size(); entity_index++)
-    {
-        Entity& entity = level.entities[entity_index];
-        switch (entity.brain)
-        {
+        int entity_index = monsters[i];
+        Vector2 position = entities.position[entity_index];
+        Vector2 velocity = entities.velocity[entity_index];
 
-        case BRAIN_PLAYER:
+        float remaining = length(velocity);
+        if (remaining == 0)
         {
-            auto& keyboard = platform.keyboard;
+            // If a monster is close enough to the player, they charge towards them.
 
-            Vector2 move = {};
-            if (keyboard.state['D'].down) move.x += 1;
-            if (keyboard.state['A'].down) move.x -= 1;
-            if (keyboard.state['W'].down) move.y += 1;
-            if (keyboard.state['S'].down) move.y -= 1;
+            bool charge = false;
+            float chance = 0.05;
 
-            float move_distance = 6 * delta_time;
-            move_entity(&entity, noz(move) * move_distance);
-            level.target_camera_position = entity.position;
+            Vector2 player_position = entities.position[player];
+            charge = (length(player_position - position) < 7);
+                /*
+                float chance = 0.01;
+                float roll = random_float(&level.random);
+                if (roll < chance)
+                {
+                    Entity fireball = {};
+                    fireball.brain = BRAIN_FIREBALL;
+                    fireball.size = { 1, 1 };
+                    fireball.position = position;
+                    fireball.velocity = noz(player_position - fireball.position) * 10;
+                    fireball.texture = the_game->art.white;
+                    fireball.friendly = false;
+                    fireball.damage = 1;
+                    add_entity(&entities, fireball);
+                }
+                */
 
-            for (Entity& other : level.entities)
+            float roll = level.monster_rolls[i];
+            if (roll < chance)
             {
-                if (&other == &entity) continue;
-                if (other.brain != BRAIN_MONSTER) continue;
-                if (!intersect_aabb_aabb(entity.position, entity.size, other.position, other.size))
+                if (charge)
                 {
-                    continue;
+                    velocity = player_position - position;
+                }
+                else
+                {
+                    float radius = 10;
+                    velocity = vector2((random_float(&level.random) * 2 - 1) * radius,
+                                       (random_float(&level.random) * 2 - 1) * radius);
                 }
-
-                the_game->state = GAME_COMBAT;
-                the_game->combat.actor = &entity;
-                the_game->combat.other = &other;
-                break;
             }
-
-            /*
-            if (platform.mouse.left_button.pressed)
+        }
+        else
+        {
+            float distance = delta_time * 10;
+            if (distance >= remaining - 1e-2)
+            {
+                distance = remaining;
+                remaining = 0;
+            }
+            else
             {
-                float mx =     platform.mouse.x / (float) platform.window.width;
-                float my = 1 - platform.mouse.y / (float) platform.window.height;
-
-                float aspect = (float) platform.window.width / (float) platform.window.height;
-                float wx = level.camera_position.x + (mx - 0.5f) * level.camera_height * aspect;
-                float wy = level.camera_position.y + (my - 0.5f) * level.camera_height;
-
-                Entity fireball = {};
-                fireball.brain = BRAIN_FIREBALL;
-                fireball.size = { 1, 1 };
-                fireball.position = entity.position;
-                fireball.velocity = noz(vector2(wx, wy) - fireball.position) * 10;
-                fireball.texture = the_game->art.white;
-                fireball.friendly = true;
-                fireball.damage = 1;
-                level.entities.push_back(fireball);
+                remaining -= distance;
             }
-            */
-        } break;
 
-        case BRAIN_MONSTER:
+            position = move_entity(position, entities.size[entity_index], noz(velocity) * distance);
+            velocity = noz(velocity) * remaining;
+        }
+
+        entities.position[entity_index] = position;
+        entities.velocity[entity_index] = velocity;
+    }
+
+    std::vector<int>& fireballs = entities.by_brain[BRAIN_FIREBALL];
+    int fireball_count = (int) fireballs.size();
+    for (int i = 0; i < fireball_count; i++)
+    {
+        int entity_index = fireballs[i];
+        Vector2 position = entities.position[entity_index] + entities.velocity[entity_index] * delta_time;
+        entities.position[entity_index] = position;
+
+        float px = position.x;
+        float py = position.y;
+        float sx = entities.size[entity_index].x * 0.5f;
+        float sy = entities.size[entity_index].y * 0.5f;
+        if (px < -sx || px > sx + level.width ||
+            py < -sy || py > sy + level.height ||
+            length(position - level.camera_position) > 12)
         {
-            float remaining = length(entity.velocity);
-            if (remaining == 0)
-            {
-                // If a monster is close enough to the player, they charge towards them.
+            remove_entity_later(&entities, entity_index);
+        }
 
-                bool charge = false;
-                float chance = 0.05;
+        bool friendly = entities.friendly[entity_index];
 
-                Vector2 player_position = find_player()->position;
-                charge = (length(player_position - entity.position) < 7);
-                    /*
-                    float chance = 0.01;
-                    float roll = random_float();
-                    if (roll < chance)
-                    {
-                        Entity fireball = {};
-                        fireball.brain = BRAIN_FIREBALL;
-                        fireball.size = { 1, 1 };
-                        fireball.position = entity.position;
-                        fireball.velocity = noz(player_position - fireball.position) * 10;
-                        fireball.texture = the_game->art.white;
-                        fireball.friendly = false;
-                        fireball.damage = 1;
-                        level.entities.push_back(fireball);
-                    }
-                    */
+        query_aabb(&level.grid, position, entities.size[entity_index], &level.query_results);
+        for (int other_index : level.query_results)
+        {
+            if (!intersect_aabb_aabb({ px, py }, { sx * 2, sy * 2 }, entities.position[other_index], entities.size[other_index]))
+            {
+                continue;
+            }
 
-                float roll = random_float();
-                if (roll < chance)
+            Brain other_brain = entities.brain[other_index];
+            if (( friendly && other_brain == BRAIN_MONSTER) ||
+                (!friendly && other_brain == BRAIN_PLAYER))
+            {
+                float& health = entities.health[other_index];
+                health -= entities.damage[entity_index];
+                if (health <= 0)
                 {
-                    if (charge)
+                    if (other_brain == BRAIN_PLAYER)
                     {
-                        entity.velocity = player_position - entity.position;
+                        health = entities.max_health[other_index];
                     }
                     else
                     {
-                        float radius = 10;
-                        entity.velocity = vector2((random_float() * 2 - 1) * radius,
-                                                  (random_float() * 2 - 1) * radius);
+                        remove_entity_later(&entities, other_index);
                     }
                 }
-            }
-            else
-            {
-                float distance = delta_time * 10;
-                if (distance >= remaining - 1e-2)
-                {
-                    distance = remaining;
-                    remaining = 0;
-                }
-                else
-                {
-                    remaining -= distance;
-                }
 
-                move_entity(&entity, noz(entity.velocity) * distance);
-                entity.velocity = noz(entity.velocity) * remaining;
+                remove_entity_later(&entities, entity_index);
+                break;
             }
-        } break;
+        }
+    }
 
-        case BRAIN_FIREBALL:
-        {
-            entity.position += entity.velocity * delta_time;
-
-            float px = entity.position.x;
-            float py = entity.position.y;
-            float sx = entity.size.x * 0.5f;
-            float sy = entity.size.y * 0.5f;
-            if (px < -sx || px > sx + level.width ||
-                py < -sy || py > sy + level.height ||
-                length(entity.position - level.camera_position) > 12)
-            {
-                erase_after_update.insert(entity_index);
-            }
+    remove_queued_entities(&entities);
 
-            for (Entity& other : level.entities)
-            {
-                if (!intersect_aabb_aabb({ px, py }, { sx * 2, sy * 2 }, other.position, other.size))
-                {
-                    continue;
-                }
+    float camera_t = min_f32(1, delta_time * 1.2f);
+    level.camera_position = lerp(level.camera_position, level.target_camera_position, camera_t);
+}
 
-                if (( entity.friendly && other.brain == BRAIN_MONSTER) ||
-                    (!entity.friendly && other.brain == BRAIN_PLAYER))
-                {
-                    other.health -= entity.damage;
-                    if (other.health <= 0)
-                    {
-                        if (other.brain == BRAIN_PLAYER)
-                        {
-                            other.health = other.max_health;
-                        }
-                        else
-                        {
-                            int index = &other - &level.entities[0];
-                            erase_after_update.insert(index);
-                        }
-                    }
+// A new world, or a new cave when the world is off, with a new seed.
+void start_level()
+{
+    if (the_game->level_path && load_level_file(the_game->level_path))
+    {
+        return;
+    }
 
-                    erase_after_update.insert(entity_index);
-                    break;
-                }
-            }
-        } break;
+    uint64 seed = next_random64(&the_game->random);
+    if (the_game->world.enabled)
+    {
+        start_world(seed);
+    }
+    else
+    {
+        generate_level_cave(64, 64, seed);
+    }
+}
+
+// Runs as many fixed steps as the frame time allows. Input that comes in as key presses is handled here,
+// once per frame, because a frame can run zero steps or several.
+void simulate_level(float delta_time)
+{
+    auto& level = the_game->level;
+    auto& simulation = the_game->simulation;
+    auto& platform = *the_game->platform;
+
+    if (platform.keyboard.state[LK_KEY_SPACE].pressed)
+    {
+        start_level();
+    }
 
+    int steps;
+    if (simulation.steps_per_frame)
+    {
+        steps = simulation.steps_per_frame;
+        simulation.accumulator = 0;
+    }
+    else
+    {
+        simulation.accumulator += delta_time;
+        steps = (int)(simulation.accumulator / SIMULATION_STEP);
+        simulation.accumulator -= steps * SIMULATION_STEP;
+        if (steps > MAX_SIMULATION_STEPS_PER_FRAME)
+        {
+            steps = MAX_SIMULATION_STEPS_PER_FRAME;
+            simulation.accumulator = 0;
         }
     }
 
-    for (auto it = erase_after_update.rbegin(); it != erase_after_update.rend(); it++)
+    for (int step = 0; step < steps; step++)
     {
-        int index = *it;
-        level.entities.erase(level.entities.begin() + index);
+        level.entities.previous_position = level.entities.position;
+        level.previous_camera_position = level.camera_position;
+
+        update_level(SIMULATION_STEP);
+
+        // Combat is against whatever the player touched, so the rest of the level waits until it's over.
+        if (the_game->state != GAME_ROGUE)
+        {
+            simulation.accumulator = 0;
+            break;
+        }
     }
 
-    float camera_t = min_f32(1, delta_time * 1.2f);
-    level.camera_position = lerp(level.camera_position, level.target_camera_position, camera_t);
+    simulation.alpha = simulation.accumulator / SIMULATION_STEP;
+}
+
+Vector2 get_render_position(int entity_index)
+{
+    auto& entities = the_game->level.entities;
+    return lerp(entities.previous_position[entity_index], entities.position[entity_index], the_game->simulation.alpha);
+}
+
+Vector2 get_render_camera_position()
+{
+    auto& level = the_game->level;
+    return lerp(level.previous_camera_position, level.camera_position, the_game->simulation.alpha);
 }
 
 Vector4 get_tile_color(int x, int y)
@@ -762,7 +1222,7 @@ Vector4 get_tile_color(int x, int y)
     auto& level = the_game->level;
     Tile* tile = level.tiles + y * level.width + x;
 
-    uint32 colors[] = { 0x5F71D9, 0x8984AB, 0x918DA8 };
+    uint32 colors[MAX_TILE_Z + 1] = { 0x5F71D9, 0x8984AB, 0x918DA8 };
     return rgb(colors[tile->z]);
 }
 
@@ -780,92 +1240,134 @@ Texture get_multiply_texture_piece(int tx, int ty)
     return result;
 }
 
-Texture get_tile_quarter_multiply(
-    int x, int y, int dx, int dy,
-    int ocx, int ocy, // outer corner
-    int icx, int icy, // inner corner
-    int fxx, int fxy, // flat X
-    int fyx, int fyy) // flat Y
+// The quarters of a tile counter clockwise from the bottom left, with the direction each one looks in for
+// lower neighbors and the multiply pieces for an outer corner, an inner corner, and an edge along x or y.
+struct Autotile_Corner
 {
-    auto& level = the_game->level;
-    Tile* tile = level.tiles + y * level.width + x;
-
-    bool x_in_bounds = (x + dx >= 0) && (x + dx < level.width);
-    bool y_in_bounds = (y + dy >= 0) && (y + dy < level.height);
-    Tile* tile_x = (x_in_bounds) ? (level.tiles + y * level.width + (x + dx)) : NULL;
-    Tile* tile_y = (y_in_bounds) ? (level.tiles + (y + dy) * level.width + x) : NULL;
-    Tile* tile_c = (x_in_bounds && y_in_bounds) ? (level.tiles + (y + dy) * level.width + (x + dx)) : NULL;
-    bool empty_x = tile_x && (tile_x->z < tile->z);
-    bool empty_y = tile_y && (tile_y->z < tile->z);
-    bool empty_c = tile_c && (tile_c->z < tile->z);
+    int dx, dy;
+    int outer_x, outer_y;
+    int inner_x, inner_y;
+    int flat_x_x, flat_x_y;
+    int flat_y_x, flat_y_y;
+};
 
-    if (!empty_x && !empty_y && empty_c)
-    {
-        return get_multiply_texture_piece(icx, icy);
-    }
+const Autotile_Corner AUTOTILE_CORNERS[4] =
+{
+    { -1, -1,   0, 1,   1, 2,   2, 1,   3, 1 },
+    {  1, -1,   1, 1,   0, 2,   3, 0,   3, 1 },
+    {  1,  1,   1, 0,   0, 3,   3, 0,   2, 0 },
+    { -1,  1,   0, 0,   1, 3,   2, 1,   2, 0 },
+};
 
-    if (empty_x && empty_y)
-    {
-        Texture full = get_multiply_texture_piece(3, 3);
-        Vector4 color = get_tile_color(x + dx, y);
-        push_rectangle({ x + 0.25f * (dx + 1), y + 0.25f * (dy + 1) }, { 0.5f, 0.5f }, full, color);
+// The piece with no edges, for plain quarters and underlays.
+const int AUTOTILE_FULL_PIECE = 3 + 4 * 3;
 
-        return get_multiply_texture_piece(ocx, ocy);
-    }
+// Has to be called after the multiply texture is loaded.
+void build_autotile_table()
+{
+    auto& autotile = the_game->autotile;
 
-    if (empty_x)
+    for (int y = 0; y < 4; y++)
     {
-        Texture full = get_multiply_texture_piece(3, 3);
-        Vector4 color = get_tile_color(x + dx, y);
-        push_rectangle({ x + 0.25f * (dx + 1), y + 0.25f * (dy + 1) }, { 0.5f, 0.5f }, full, color);
-
-        return get_multiply_texture_piece(fxx, fxy);
+        for (int x = 0; x < 4; x++)
+        {
+            autotile.pieces[x + 4 * y] = get_multiply_texture_piece(x, y);
+        }
     }
 
-    if (empty_y)
+    for (int mask = 0; mask < 256; mask++)
     {
-        Texture full = get_multiply_texture_piece(3, 3);
-        Vector4 color = get_tile_color(x, y + dy);
-        push_rectangle({ x + 0.25f * (dx + 1), y + 0.25f * (dy + 1) }, { 0.5f, 0.5f }, full, color);
+        for (int i = 0; i < 4; i++)
+        {
+            const Autotile_Corner& corner = AUTOTILE_CORNERS[i];
+            bool empty_x = mask & (1 << get_autotile_bit(corner.dx, 0));
+            bool empty_y = mask & (1 << get_autotile_bit(0, corner.dy));
+            bool empty_c = mask & (1 << get_autotile_bit(corner.dx, corner.dy));
 
-        return get_multiply_texture_piece(fyx, fyy);
-    }
+            Autotile_Quarter quarter = { AUTOTILE_FULL_PIECE, UNDERLAY_NONE };
+            if (empty_x && empty_y)
+            {
+                quarter.piece = corner.outer_x + 4 * corner.outer_y;
+                quarter.underlay = UNDERLAY_X;
+            }
+            else if (empty_x)
+            {
+                quarter.piece = corner.flat_x_x + 4 * corner.flat_x_y;
+                quarter.underlay = UNDERLAY_X;
+            }
+            else if (empty_y)
+            {
+                quarter.piece = corner.flat_y_x + 4 * corner.flat_y_y;
+                quarter.underlay = UNDERLAY_Y;
+            }
+            else if (empty_c)
+            {
+                quarter.piece = corner.inner_x + 4 * corner.inner_y;
+            }
 
-    return get_multiply_texture_piece(3, 3);
+            autotile.quarters[mask][i] = quarter;
+        }
+    }
 }
 
 void render_tile(int x, int y)
 {
+    auto& level = the_game->level;
+    auto& autotile = the_game->autotile;
+
     Vector4 color = get_tile_color(x, y);
+    Autotile_Quarter* quarters = autotile.quarters[level.autotile[y * level.width + x]];
+
+    // Underlays go first so the quarters are drawn over them.
+    for (int i = 0; i < 4; i++)
+    {
+        const Autotile_Corner& corner = AUTOTILE_CORNERS[i];
+        Vector2 position = { x + 0.25f * (corner.dx + 1), y + 0.25f * (corner.dy + 1) };
+        Texture full = autotile.pieces[AUTOTILE_FULL_PIECE];
 
-    Texture multiply00 = get_tile_quarter_multiply(x, y, -1, -1, 0, 1, 1, 2, 2, 1, 3, 1);
-    Texture multiply10 = get_tile_quarter_multiply(x, y,  1, -1, 1, 1, 0, 2, 3, 0, 3, 1);
-    Texture multiply11 = get_tile_quarter_multiply(x, y,  1,  1, 1, 0, 0, 3, 3, 0, 2, 0);
-    Texture multiply01 = get_tile_quarter_multiply(x, y, -1,  1, 0, 0, 1, 3, 2, 1, 2, 0);
+        if (quarters[i].underlay == UNDERLAY_X)
+        {
+            push_rectangle(position, { 0.5f, 0.5f }, full, get_tile_color(x + corner.dx, y));
+        }
+        else if (quarters[i].underlay == UNDERLAY_Y)
+        {
+            push_rectangle(position, { 0.5f, 0.5f }, full, get_tile_color(x, y + corner.dy));
+        }
+    }
 
-    push_rectangle({ (float) x + 0.0f, (float) y + 0.0f }, { 0.5f, 0.5f }, multiply00, color);
-    push_rectangle({ (float) x + 0.5f, (float) y + 0.0f }, { 0.5f, 0.5f }, multiply10, color);
-    push_rectangle({ (float) x + 0.5f, (float) y + 0.5f }, { 0.5f, 0.5f }, multiply11, color);
-    push_rectangle({ (float) x + 0.0f, (float) y + 0.5f }, { 0.5f, 0.5f }, multiply01, color);
+    for (int i = 0; i < 4; i++)
+    {
+        const Autotile_Corner& corner = AUTOTILE_CORNERS[i];
+        Vector2 position = { x + 0.25f * (corner.dx + 1), y + 0.25f * (corner.dy + 1) };
+        push_rectangle(position, { 0.5f, 0.5f }, autotile.pieces[quarters[i].piece], color);
+    }
 }
 
-void render_level()
+void bake_chunk(int chunk_x, int chunk_y)
 {
     auto& level = the_game->level;
+    Level_Chunk* chunk = &level.chunks[chunk_y * level.chunks_x + chunk_x];
 
-    for (int tile_y = 0; tile_y < level.height; tile_y++)
+    int min_x = chunk_x * CHUNK_SIZE;
+    int min_y = chunk_y * CHUNK_SIZE;
+    int max_x = min_i32(min_x + CHUNK_SIZE, level.width);
+    int max_y = min_i32(min_y + CHUNK_SIZE, level.height);
+
+    begin_bake();
+
+    for (int tile_y = min_y; tile_y < max_y; tile_y++)
     {
-        for (int tile_x = 0; tile_x < level.width; tile_x++)
+        for (int tile_x = min_x; tile_x < max_x; tile_x++)
         {
             render_tile(tile_x, tile_y);
         }
     }
 
-    rendering_flush(&the_game->renderer);
+    bake_mesh(&the_game->renderer, &chunk->tile_mesh);
 
-    for (int tile_y = 0; tile_y < level.height; tile_y++)
+    for (int tile_y = min_y; tile_y < max_y; tile_y++)
     {
-        for (int tile_x = 0; tile_x < level.width; tile_x++)
+        for (int tile_x = min_x; tile_x < max_x; tile_x++)
         {
             int variation = (tile_x * 59351 + tile_y * 903961) % 4;
             int vx = (variation & 1) * 0.5f;
@@ -882,15 +1384,70 @@ void render_level()
         }
     }
 
-    rendering_flush(&the_game->renderer, true);
+    bake_mesh(&the_game->renderer, &chunk->stone_mesh);
+    chunk->dirty = false;
+}
+
+void render_level()
+{
+    auto& level = the_game->level;
+    auto& renderer = the_game->renderer;
+
+    // Only the chunks that overlap the camera view are baked and drawn.
+    Vector2 view_size = vector2(renderer.camera_width, renderer.camera_height);
+    Vector2 camera_position = get_render_camera_position();
+    Vector2 view_min = camera_position - view_size * 0.5f;
+    Vector2 view_max = camera_position + view_size * 0.5f;
 
-    for (Entity& entity : level.entities)
+    int min_chunk_x = max_i32((int) floorf(view_min.x / CHUNK_SIZE), 0);
+    int min_chunk_y = max_i32((int) floorf(view_min.y / CHUNK_SIZE), 0);
+    int max_chunk_x = min_i32((int) floorf(view_max.x / CHUNK_SIZE), level.chunks_x - 1);
+    int max_chunk_y = min_i32((int) floorf(view_max.y / CHUNK_SIZE), level.chunks_y - 1);
+
+    set_render_state(LAYER_TILES);
+
+    for (int chunk_y = min_chunk_y; chunk_y <= max_chunk_y; chunk_y++)
     {
-        push_centered_rectangle(entity.position, entity.size * 1.5f, the_game->art.shadow);
-        push_centered_rectangle(entity.position, entity.size, entity.texture);
+        for (int chunk_x = min_chunk_x; chunk_x <= max_chunk_x; chunk_x++)
+        {
+            Level_Chunk* chunk = &level.chunks[chunk_y * level.chunks_x + chunk_x];
+            if (chunk->dirty)
+            {
+                bake_chunk(chunk_x, chunk_y);
+            }
+
+            submit_mesh(&chunk->tile_mesh);
+        }
     }
 
-    rendering_flush(&the_game->renderer);
+    set_render_state(LAYER_TILE_DETAIL, BLEND_MULTIPLY);
+
+    for (int chunk_y = min_chunk_y; chunk_y <= max_chunk_y; chunk_y++)
+    {
+        for (int chunk_x = min_chunk_x; chunk_x <= max_chunk_x; chunk_x++)
+        {
+            Level_Chunk* chunk = &level.chunks[chunk_y * level.chunks_x + chunk_x];
+            submit_mesh(&chunk->stone_mesh);
+        }
+    }
+
+    set_render_state(LAYER_ENTITIES);
+
+    auto& entities = level.entities;
+    for (int entity_index = 0; entity_index < entities.count; entity_index++)
+    {
+        Vector2 position = get_render_position(entity_index);
+        Vector2 size = entities.size[entity_index];
+        Vector2 extent = size * 0.75f;
+        if (position.x + extent.x < view_min.x || position.x - extent.x > view_max.x ||
+            position.y + extent.y < view_min.y || position.y - extent.y > view_max.y)
+        {
+            continue;
+        }
+
+        push_centered_rectangle(position, size * 1.5f, the_game->art.shadow);
+        push_centered_rectangle(position, size, entities.texture[entity_index]);
+    }
 }
 
 bool does_tile_create_shadow(int x, int y)
@@ -898,50 +1455,43 @@ bool does_tile_create_shadow(int x, int y)
     auto& level = the_game->level;
     if (x < 0 || x >= level.width)  return true;
     if (y < 0 || y >= level.height) return true;
-    return level.tiles[y * level.width + x].z;
+    return get_bit(&level.solid, x, y);
 }
 
 void render_shadows()
 {
     auto& level = the_game->level;
     auto& renderer = the_game->renderer;
+    Shadow_Map* map = &renderer.shadow_map;
 
-    uint8* pixels = (uint8*) calloc(1, (level.width + 1) * (level.height + 1) * 4);
+    // Shadow texels sit on tile corners, so the map is one bigger than the level in each direction.
+    if (map->width != level.width + 1 || map->height != level.height + 1)
+    {
+        resize_shadow_map(&renderer, level.width + 1, level.height + 1);
+    }
 
-    for (int tile_y = 0; tile_y <= level.height; tile_y++)
+    if (map->dirty)
     {
-        for (int tile_x = 0; tile_x <= level.width; tile_x++)
+        for (int tile_y = map->dirty_min_y; tile_y <= map->dirty_max_y; tile_y++)
         {
-            int count = 0;
-            count += does_tile_create_shadow(tile_x - 1, tile_y - 1) ? 1 : 0;
-            count += does_tile_create_shadow(tile_x - 0, tile_y - 1) ? 1 : 0;
-            count += does_tile_create_shadow(tile_x - 1, tile_y - 0) ? 1 : 0;
-            count += does_tile_create_shadow(tile_x - 0, tile_y - 0) ? 1 : 0;
-
-            const uint8 COUNT_TO_ALPHA[] = { 0, 20, 20, 50, 150 };
-            uint8 alpha = COUNT_TO_ALPHA[count];
-            pixels[(tile_y * (level.width + 1) + tile_x) * 4 + 3] = alpha;
+            for (int tile_x = map->dirty_min_x; tile_x <= map->dirty_max_x; tile_x++)
+            {
+                int count = 0;
+                count += does_tile_create_shadow(tile_x - 1, tile_y - 1) ? 1 : 0;
+                count += does_tile_create_shadow(tile_x - 0, tile_y - 1) ? 1 : 0;
+                count += does_tile_create_shadow(tile_x - 1, tile_y - 0) ? 1 : 0;
+                count += does_tile_create_shadow(tile_x - 0, tile_y - 0) ? 1 : 0;
+
+                const uint8 COUNT_TO_ALPHA[] = { 0, 20, 20, 50, 150 };
+                map->pixels[tile_y * map->width + tile_x] = COUNT_TO_ALPHA[count];
+            }
         }
-    }
 
-    GLuint shadow_texture;
-    glGenTextures(1, &shadow_texture);
-    glBindTexture(GL_TEXTURE_2D, shadow_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, level.width + 1, level.height + 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-
-    free(pixels);
-
-    GLuint atlas = renderer.atlas_texture;
-    renderer.atlas_texture = shadow_texture;
+        upload_shadow_map(&renderer);
+    }
 
+    set_render_state(LAYER_SHADOWS, BLEND_ALPHA, TEXTURE_SHADOW_MAP);
     push_rectangle(-0.5, -0.5, level.width + 1, level.height + 1, 0, 0, 1, 1, vector4(1, 1, 1, 1));
-    rendering_flush(&renderer);
-
-    renderer.atlas_texture = atlas;
-
-    glDeleteTextures(1, &shadow_texture);
 }
 
 void render_ui()
@@ -949,12 +1499,15 @@ void render_ui()
     float aspect = (float) the_game->platform->window.width / (float) the_game->platform->window.height;
     the_game->renderer.camera_height = 16;
     the_game->renderer.camera_width = the_game->renderer.camera_height * aspect;
-    the_game->renderer.camera_transform = orthographic(
+    set_camera(orthographic(
         0, the_game->renderer.camera_width,
         0, the_game->renderer.camera_height,
-        -1, 1);
+        -1, 1));
+    set_render_state(LAYER_UI);
 
-    Entity* player = find_player();
+    auto& entities = the_game->level.entities;
+    int player = find_player(&entities);
+    if (player < 0) return;
 
     float stat_x = 1;
     float stat_y = 15;
@@ -962,13 +1515,12 @@ void render_ui()
     Vector4 red = vector4(1, 0.3, 0.3, 1);
     Vector4 black = vector4(0, 0, 0, 1);
 
-    float health_percentage = player->health / player->max_health;
+    float health_percentage = entities.health[player] / entities.max_health[player];
 
     push_rectangle(stat_x, stat_y, 4, 0.5, the_game->art.white, black);
     push_rectangle(stat_x + 0.05, stat_y + 0.05, 3.9 * health_percentage, 0.4, the_game->art.white, red);
     render_string("HEALTH", stat_x + 4.55, stat_y - 0.15, 0.5, 0.5, black);
     render_string("HEALTH", stat_x + 4.50, stat_y - 0.10, 0.5, 0.5, red);
-    rendering_flush(&the_game->renderer);
 }
 
 void render_combat_screen()
@@ -976,20 +1528,37 @@ void render_combat_screen()
     auto& platform = the_game->platform;
     auto& combat = the_game->combat;
 
-    glClearColor(0.1, 0.1, 0.1, 1);
-    glClear(GL_COLOR_BUFFER_BIT);
+    clear_frame(&the_game->renderer, vector4(0.1, 0.1, 0.1, 1));
 
     float aspect = (float) platform->window.width / (float) platform->window.height;
     float camera_height = 16;
     float camera_width = camera_height * aspect;
-    the_game->renderer.camera_transform = orthographic(
-        -0.5 * camera_width, 0.5 * camera_width,
-        -0.5 * camera_height, 0.5 * camera_height,
-        -1, 1);
 
     float left  = max_f32(-0.25 * camera_width, -5);
     float right = min_f32( 0.25 * camera_width,  5);
 
+    // Examining zooms the whole screen onto the monster for a second. The camera only applies to quads
+    // pushed after it's set, so it's picked before anything is pushed.
+    if (combat.state == COMBAT_ACTOR_EXAMINE && combat.state_time < 1)
+    {
+        float camera_x = right;
+        float camera_y = 4.5;
+        float zoom_height = 9;
+        float zoom_width = zoom_height * aspect;
+        set_camera(orthographic(
+            camera_x - 0.5 * zoom_width, camera_x + 0.5 * zoom_width,
+            camera_y - 0.5 * zoom_height, camera_y + 0.5 * zoom_height,
+            -1, 1));
+    }
+    else
+    {
+        set_camera(orthographic(
+            -0.5 * camera_width, 0.5 * camera_width,
+            -0.5 * camera_height, 0.5 * camera_height,
+            -1, 1));
+    }
+    set_render_state(LAYER_UI);
+
     Vector4 white = vector4(1.0, 1.0, 1.0, 1);
     Vector4 gray  = vector4(0.3, 0.3, 0.3, 1);
     Vector4 red   = vector4(1.0, 0.3, 0.3, 1);
@@ -997,14 +1566,21 @@ void render_combat_screen()
     render_centered_string("YOUR NAME", left, 0, 0.5, 0.5, white);
     render_centered_string("SCARY MONSTER", right, 0, 0.5, 0.5, white);
 
-    Entity* actor = combat.actor;
-    Entity* other = combat.other;
-    push_centered_rectangle({ left,  4.5 }, actor->size * 2, actor->texture);
-    push_centered_rectangle({ right, 4.5 }, other->size * 2, other->texture);
+    auto& entities = the_game->level.entities;
+    int actor = get_entity_index(&entities, combat.actor);
+    int other = get_entity_index(&entities, combat.other);
+    if (actor < 0 || other < 0)
+    {
+        the_game->state = GAME_ROGUE;
+        return;
+    }
+
+    push_centered_rectangle({ left,  4.5 }, entities.size[actor] * 2, entities.texture[actor]);
+    push_centered_rectangle({ right, 4.5 }, entities.size[other] * 2, entities.texture[other]);
 
     float bar_width = 6;
-    float actor_health_percentage = actor->health / actor->max_health;
-    float other_health_percentage = other->health / other->max_health;
+    float actor_health_percentage = entities.health[actor] / entities.max_health[actor];
+    float other_health_percentage = entities.health[other] / entities.max_health[other];
     render_centered_string("HEALTH", left,  -1.5, 0.5, 0.5, red);
     render_centered_string("HEALTH", right, -1.5, 0.5, 0.5, red);
     push_rectangle(left  - bar_width * 0.5, -2, bar_width, 0.5, the_game->art.white, gray);
@@ -1034,11 +1610,9 @@ void render_combat_screen()
         if (platform->keyboard.state[LK_KEY_3].pressed) combat.state = COMBAT_ACTOR_EXAMINE;
         if (platform->keyboard.state[LK_KEY_4].pressed) combat.state = COMBAT_ACTOR_FLEE;
 
-        if (other->health <= 0)
+        if (entities.health[other] <= 0)
         {
-            auto& entities = the_game->level.entities;
-            int other_index = other - &entities[0];
-            entities.erase(entities.begin() + other_index);
+            remove_entity(&entities, other);
 
             the_game->state = GAME_ROGUE;
             return;
@@ -1065,10 +1639,10 @@ void render_combat_screen()
                     float damage = 1;
                     damage *= score;
 
-                    other->health -= damage;
-                    if (other->health < 0)
+                    entities.health[other] -= damage;
+                    if (entities.health[other] < 0)
                     {
-                        other->health = 0;
+                        entities.health[other] = 0;
                     }
                 }
                 combat.dealt_damage = true;
@@ -1105,18 +1679,6 @@ void render_combat_screen()
     }
     else if (combat.state == COMBAT_ACTOR_EXAMINE)
     {
-        if (combat.state_time < 1)
-        {
-            float camera_x = right;
-            float camera_y = 4.5;
-            float camera_height = 9;
-            float camera_width = camera_height * aspect;
-            the_game->renderer.camera_transform = orthographic(
-                camera_x - 0.5 * camera_width, camera_x + 0.5 * camera_width,
-                camera_y - 0.5 * camera_height, camera_y + 0.5 * camera_height,
-                -1, 1);
-        }
-
         title = "YOU EXAMINE THE CREATURE...";
         has_back = true;
 
@@ -1157,14 +1719,14 @@ void render_combat_screen()
     if (combat.doing_rhythm)
     {
         combat.display_rhythm_score = true;
-        rendering_flush(&the_game->renderer);
 
         float aspect = (float) platform->window.width / (float) platform->window.height;
         the_game->renderer.camera_height = 8;
         the_game->renderer.camera_width = the_game->renderer.camera_height * aspect;
-        the_game->renderer.camera_transform = orthographic(
+        set_camera(orthographic(
             0, the_game->renderer.camera_width,
-            0, the_game->renderer.camera_height, -1, 1);
+            0, the_game->renderer.camera_height, -1, 1));
+        set_render_state(LAYER_RHYTHM);
 
         rhythm_controls();
         rhythm_render();
@@ -1191,7 +1753,7 @@ void render_combat_screen()
             float x = (i < 2) ? left : right;
             float y = (i & 1) ? -6 : -5;
 
-            char number[2] = { '1' + (char) i, 0 };
+            char number[2] = { (char)('1' + i), 0 };
             render_string(number, x - 3, y, 0.5, 0.5, red);
             render_string(option, x - 2, y, 0.5, 0.5, white);
         }
@@ -1202,13 +1764,45 @@ void render_combat_screen()
             render_string("BACK", -1, -7.5, 0.5, 0.5, white);
         }
     }
+}
+
+#ifdef LD41_BENCHMARKS
+#include "benchmarks.inl"
+#endif
+
+// See Game::capture.
+static void capture_frame(Game* game)
+{
+    auto& capture = game->capture;
+    if (capture.check)
+    {
+        int different = compare_frame_tga(&game->renderer, capture.path);
+        if (different != 0)
+        {
+            if (different > 0)
+            {
+                printf("Mismatch: %d pixels of frame %d differ from %s\n", different, capture.frame, capture.path);
+            }
+            exit(1);
+        }
+        printf("Frame %d matches %s\n", capture.frame, capture.path);
+    }
+    else
+    {
+        if (!save_frame_tga(&game->renderer, capture.path)) exit(1);
+        printf("Saved frame %d to %s\n", capture.frame, capture.path);
+    }
 
-    rendering_flush(&the_game->renderer);
+    game->platform->break_frame_loop = true;
 }
 
 LK_CLIENT_EXPORT
 void lk_client_init(LK_Platform* platform)
 {
+#ifdef LD41_BENCHMARKS
+    run_benchmarks(platform);
+#endif
+
     platform->window.title = strdup("LD41");
     platform->window.width = 900;
     platform->window.height = 600;
@@ -1222,17 +1816,61 @@ void lk_client_init(LK_Platform* platform)
 
     platform->audio.strategy = LK_AUDIO_MIXER;
 
+    // For machines without a GPU, for platforms that can't open a window, and for frame dumps, which are
+    // of the software renderer's output. The frame is rasterized on the CPU into the window canvas.
+    const char* dump_frame = getenv("LD41_DUMP_FRAME");
+    const char* check_frame = getenv("LD41_CHECK_FRAME");
+    if (getenv("LD41_SOFTWARE_RENDERER") || platform->window.no_window || dump_frame || check_frame)
+    {
+        platform->window.backend = LK_WINDOW_CANVAS;
+    }
+
     Game* game = (Game*) calloc(1, sizeof(Game));
     new (game) Game;
 
     game->platform = platform;
     platform->client_data = game;
+
+    uint64 seed = std::chrono::system_clock::now().time_since_epoch().count();
+    if (const char* seed_text = getenv("LD41_SEED"))
+    {
+        seed = strtoull(seed_text, NULL, 10);
+    }
+    game->random = seed_random(seed);
+
+    if (const char* steps = getenv("LD41_STEPS_PER_FRAME"))
+    {
+        game->simulation.steps_per_frame = max_i32(atoi(steps), 0);
+    }
+
+    if (const char* capture = check_frame ? check_frame : dump_frame)
+    {
+        char* end;
+        game->capture.frame = (int) strtol(capture, &end, 10);
+        game->capture.path = (*end == ':') ? end + 1 : "";
+        game->capture.check = (capture == check_frame);
+        if (game->capture.frame < 1 || !*game->capture.path)
+        {
+            printf("Expected <frame>:<path>, got %s\n", capture);
+            exit(1);
+        }
+    }
+
+    game->level_path = getenv("LD41_LEVEL");
+    game->world.enabled = !getenv("LD41_FIXED_LEVEL") && !game->level_path;
+
+    if (const char* image_path = getenv("LD41_CONVERT_LEVEL"))
+    {
+        the_game = game;
+        convert_level_image(image_path);
+        platform->break_frame_loop = true;
+    }
 }
 
 LK_CLIENT_EXPORT
 void lk_client_frame(LK_Platform* platform)
 {
-    if (!glewExperimental)
+    if (platform->window.backend == LK_WINDOW_OPENGL && !glewExperimental)
     {
         glewExperimental = true;
         glewInit();
@@ -1257,22 +1895,54 @@ void lk_client_frame(LK_Platform* platform)
         game->sounds.kick = load_wav_file("data/sounds/kick.wav");
         game->sounds.snare = load_wav_file("data/sounds/snare.wav");
 
+        build_autotile_table();
+
+        game->renderer.backend = (platform->window.backend == LK_WINDOW_CANVAS) ? RENDER_SOFTWARE : RENDER_OPENGL;
         init_renderer(&game->renderer);
         game->initialized = true;
     }
 
     if (!game->level.tiles)
     {
-        generate_level_cave(64, 64);
+        start_level();
+    }
+
+    if (game->world.enabled)
+    {
+        stream_world();
     }
 
     if (game->state == GAME_ROGUE)
     {
         float delta_time = platform->time.delta_seconds;
-        update_level(delta_time);
+        simulate_level(delta_time);
     }
 
-    glViewport(0, 0, platform->window.width, platform->window.height);
+    begin_frame(&game->renderer);
+    if (platform->keyboard.state[LK_KEY_F1].pressed)
+    {
+        Buffer_Mode mode = (Buffer_Mode)((game->renderer.buffer_mode + 1) % BUFFER_MODE_COUNT);
+        set_buffer_mode(&game->renderer, mode);
+        print_render_stats(&game->renderer);
+    }
+    if (platform->keyboard.state[LK_KEY_F2].pressed)
+    {
+        print_render_stats(&game->renderer);
+    }
+    if (platform->keyboard.state[LK_KEY_F3].pressed)
+    {
+        set_instanced(!render_instanced);
+        print_render_stats(&game->renderer);
+    }
+
+    if (platform->canvas.data)
+    {
+        set_viewport(&game->renderer, platform->canvas.width, platform->canvas.height, (uint32*) platform->canvas.data);
+    }
+    else
+    {
+        set_viewport(&game->renderer, platform->window.width, platform->window.height);
+    }
 
     if (game->state == GAME_COMBAT)
     {
@@ -1280,26 +1950,52 @@ void lk_client_frame(LK_Platform* platform)
     }
     else
     {
-        glClearColor(0, 0, 0, 1);
-        glClear(GL_COLOR_BUFFER_BIT);
+        clear_frame(&game->renderer, vector4(0, 0, 0, 1));
 
         float aspect = (float) platform->window.width / (float) platform->window.height;
-        float camera_x = the_game->level.camera_position.x;
-        float camera_y = the_game->level.camera_position.y;
+        Vector2 camera_position = get_render_camera_position();
+        float camera_x = camera_position.x;
+        float camera_y = camera_position.y;
         game->renderer.camera_height = the_game->level.camera_height;
         game->renderer.camera_width = game->renderer.camera_height * aspect;
-        game->renderer.camera_transform = orthographic(
+        set_camera(orthographic(
             camera_x - game->renderer.camera_width  * 0.5, camera_x + game->renderer.camera_width  * 0.5,
             camera_y - game->renderer.camera_height * 0.5, camera_y + game->renderer.camera_height * 0.5,
-            -1, 1);
+            -1, 1));
 
         render_level();
         render_shadows();
         render_ui();
     }
+
+    render_frame(&game->renderer);
+
+    if (platform->keyboard.state[LK_KEY_F4].pressed)
+    {
+        if (save_frame_tga(&game->renderer, "frame.tga"))
+        {
+            printf("Saved frame.tga\n");
+        }
+    }
+
+    game->capture.frame_count++;
+    if (game->capture.frame_count == game->capture.frame)
+    {
+        capture_frame(game);
+    }
 }
 
 LK_CLIENT_EXPORT
 void lk_client_close(LK_Platform* platform)
 {
 }
+
+// Called before the game library is unloaded, for a hot reload and at exit. The new library starts its
+// own threads when it needs them.
+LK_CLIENT_EXPORT
+void lk_client_unload(LK_Platform* platform)
+{
+    the_game = (Game*) platform->client_data;
+    stop_world_generator();
+    stop_thread_pool();
+}
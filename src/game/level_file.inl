@@ -0,0 +1,283 @@
+// Levels saved by save_level_file are loaded by mapping the file into memory with the platform's file.map
+// and reading the header, tile rows and entity table where they lie, without reading the file first. The
+// tiles are unpacked into a new tile array. Every section starts 8 byte aligned and the file is a whole
+// number of 64 bit words, all little endian:
+//
+//     Level_File_Header
+//     tile rows, height rows of tile_stride words, LEVEL_FILE_TILES_PER_WORD tiles per word
+//     entity table, entity_count Level_File_Entity records
+//
+// The checksum covers every word after the header. Run with LD41_CONVERT_LEVEL=<image> to convert a level
+// image into this format, next to the image with the extension swapped for LEVEL_FILE_EXTENSION.
+const uint32 LEVEL_FILE_MAGIC = 0x4C31344C; // "L41L"
+const uint32 LEVEL_FILE_VERSION = 1;
+const int LEVEL_FILE_TILE_BITS = 2;
+const int LEVEL_FILE_TILES_PER_WORD = 64 / LEVEL_FILE_TILE_BITS;
+const char LEVEL_FILE_EXTENSION[] = ".lvl";
+
+struct Level_File_Header
+{
+    uint32 magic;
+    uint32 version;
+    int32 width;
+    int32 height;
+    int32 tile_stride; // in words
+    int32 entity_count;
+    uint64 tile_offset;
+    uint64 entity_offset;
+    uint64 file_size;
+    uint64 checksum;
+};
+
+struct Level_File_Entity
+{
+    uint32 brain;
+    float position_x;
+    float position_y;
+    float size_x;
+    float size_y;
+    float health;
+    float max_health;
+    float damage;
+};
+
+static uint64 get_level_file_checksum(const uint64* words, uint64 count)
+{
+    uint64 hash = 0x9E3779B97F4A7C15ULL;
+    for (uint64 i = 0; i < count; i++)
+    {
+        hash = (hash ^ words[i]) * 0xFF51AFD7ED558CCDULL;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+static Texture get_entity_texture(Brain brain)
+{
+    return (brain == BRAIN_TREASURE) ? the_game->art.barrel : the_game->art.white;
+}
+
+bool save_level_file(const char* path)
+{
+    auto& level = the_game->level;
+    auto& entities = level.entities;
+
+    Level_File_Header header = {};
+    header.magic = LEVEL_FILE_MAGIC;
+    header.version = LEVEL_FILE_VERSION;
+    header.width = level.width;
+    header.height = level.height;
+    header.tile_stride = (level.width + LEVEL_FILE_TILES_PER_WORD - 1) / LEVEL_FILE_TILES_PER_WORD;
+    header.entity_count = entities.count;
+
+    // The header and the entity records are whole words, so everything after the header is one buffer.
+    uint64 tile_words = (uint64) header.tile_stride * level.height;
+    uint64 entity_words = (uint64) entities.count * sizeof(Level_File_Entity) / sizeof(uint64);
+    std::vector<uint64> words(tile_words + entity_words, 0);
+
+    header.tile_offset = sizeof(Level_File_Header);
+    header.entity_offset = header.tile_offset + tile_words * sizeof(uint64);
+    header.file_size = header.entity_offset + entity_words * sizeof(uint64);
+
+    for (int y = 0; y < level.height; y++)
+    {
+        for (int x = 0; x < level.width; x++)
+        {
+            int z = level.tiles[y * level.width + x].z;
+            if (z < 0 || z > MAX_TILE_Z)
+            {
+                printf("Tile height %d at %d, %d is out of range\n", z, x, y);
+                return false;
+            }
+
+            uint64& word = words[y * header.tile_stride + x / LEVEL_FILE_TILES_PER_WORD];
+            word |= (uint64) z << ((x % LEVEL_FILE_TILES_PER_WORD) * LEVEL_FILE_TILE_BITS);
+        }
+    }
+
+    Level_File_Entity* records = (Level_File_Entity*)(words.data() + tile_words);
+    for (int entity_index = 0; entity_index < entities.count; entity_index++)
+    {
+        Level_File_Entity& record = records[entity_index];
+        record.brain = entities.brain[entity_index];
+        record.position_x = entities.position[entity_index].x;
+        record.position_y = entities.position[entity_index].y;
+        record.size_x = entities.size[entity_index].x;
+        record.size_y = entities.size[entity_index].y;
+        record.health = entities.health[entity_index];
+        record.max_health = entities.max_health[entity_index];
+        record.damage = entities.damage[entity_index];
+    }
+
+    header.checksum = get_level_file_checksum(words.data(), words.size());
+
+    FILE* file = fopen(path, "wb");
+    if (!file)
+    {
+        printf("Failed to open %s for writing\n", path);
+        return false;
+    }
+
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(words.data(), sizeof(uint64), words.size(), file);
+    fclose(file);
+    return true;
+}
+
+static bool is_level_file_valid(LK_Mapped_File* mapped)
+{
+    if (mapped->size < sizeof(Level_File_Header)) return false;
+
+    Level_File_Header* header = (Level_File_Header*) mapped->data;
+    if (header->magic != LEVEL_FILE_MAGIC || header->version != LEVEL_FILE_VERSION) return false;
+    if (header->file_size != mapped->size || mapped->size % sizeof(uint64)) return false;
+    if (header->width <= 0 || header->height <= 0 || header->entity_count < 0) return false;
+    if (header->tile_stride != (header->width + LEVEL_FILE_TILES_PER_WORD - 1) / LEVEL_FILE_TILES_PER_WORD) return false;
+
+    uint64 tile_size = (uint64) header->tile_stride * header->height * sizeof(uint64);
+    uint64 entity_size = (uint64) header->entity_count * sizeof(Level_File_Entity);
+    if (header->tile_offset != sizeof(Level_File_Header)) return false;
+    if (header->entity_offset != header->tile_offset + tile_size) return false;
+    if (header->entity_offset + entity_size != header->file_size) return false;
+
+    const uint64* words = (const uint64*)(mapped->data + sizeof(Level_File_Header));
+    uint64 count = (mapped->size - sizeof(Level_File_Header)) / sizeof(uint64);
+    return get_level_file_checksum(words, count) == header->checksum;
+}
+
+// Leaves the current level alone if the file can't be loaded. Besides the checksum, the tiles have to be
+// heights the game has and there has to be exactly one player, which is all the game assumes about a level.
+bool load_level_file(const char* path)
+{
+    LK_Platform* platform = the_game->platform;
+    LK_Mapped_File mapped;
+    if (!platform->file.map(path, &mapped))
+    {
+        printf("Failed to open file %s\n", path);
+        return false;
+    }
+
+    if (!is_level_file_valid(&mapped))
+    {
+        printf("%s is not a valid level file\n", path);
+        platform->file.unmap(&mapped);
+        return false;
+    }
+
+    Level_File_Header* header = (Level_File_Header*) mapped.data;
+    const uint64* rows = (const uint64*)(mapped.data + header->tile_offset);
+    const Level_File_Entity* records = (const Level_File_Entity*)(mapped.data + header->entity_offset);
+
+    int player_count = 0;
+    for (int i = 0; i < header->entity_count; i++)
+    {
+        player_count += (records[i].brain == BRAIN_PLAYER);
+    }
+    if (player_count != 1)
+    {
+        printf("%s has %d players instead of one\n", path, player_count);
+        platform->file.unmap(&mapped);
+        return false;
+    }
+
+    const uint64 tile_mask = (1 << LEVEL_FILE_TILE_BITS) - 1;
+    Tile* tiles = new Tile[header->width * header->height];
+    for (int y = 0; y < header->height; y++)
+    {
+        const uint64* row = rows + y * header->tile_stride;
+        for (int x = 0; x < header->width; x++)
+        {
+            uint64 word = row[x / LEVEL_FILE_TILES_PER_WORD];
+            int z = (word >> ((x % LEVEL_FILE_TILES_PER_WORD) * LEVEL_FILE_TILE_BITS)) & tile_mask;
+            if (z > MAX_TILE_Z)
+            {
+                printf("%s has a tile of height %d at %d, %d\n", path, z, x, y);
+                delete[] tiles;
+                platform->file.unmap(&mapped);
+                return false;
+            }
+            tiles[y * header->width + x].z = z;
+        }
+    }
+
+    auto& level = the_game->level;
+    level.width = header->width;
+    level.height = header->height;
+    if (level.tiles)
+    {
+        delete[] level.tiles;
+    }
+    level.tiles = tiles;
+
+    clear_entities(&level.entities);
+    for (int i = 0; i < header->entity_count; i++)
+    {
+        const Level_File_Entity& record = records[i];
+        if (record.brain >= BRAIN_COUNT) continue;
+
+        Entity entity = {};
+        entity.brain = (Brain) record.brain;
+        entity.position = vector2(record.position_x, record.position_y);
+        entity.size = vector2(record.size_x, record.size_y);
+        entity.texture = get_entity_texture(entity.brain);
+        entity.health = record.health;
+        entity.max_health = record.max_health;
+        entity.damage = record.damage;
+        add_entity(&level.entities, entity);
+    }
+
+    // The same file always plays out the same way.
+    level.random = generator_random(header->checksum, GENERATOR_STREAM_MONSTERS, 0);
+
+    platform->file.unmap(&mapped);
+
+    tiles_changed(0, 0, level.width - 1, level.height - 1);
+    return true;
+}
+
+// Writes the level file for an image level, returns false if the image can't be loaded, has no room for the
+// player or the file can't be written.
+// Images only have tiles, the player goes somewhere in the largest region so the level is playable.
+bool place_level_image_player(const char* image_path)
+{
+    auto& level = the_game->level;
+    clear_entities(&level.entities);
+
+    Spawn_Regions regions = {};
+    find_spawn_regions(&level.solid, &regions);
+    int region = find_largest_region(&regions);
+    if (region < 0)
+    {
+        printf("%s has no room for the player\n", image_path);
+        return false;
+    }
+
+    Random random = seed_random(0);
+
+    Entity player = {};
+    player.brain = BRAIN_PLAYER;
+    player.size = vector2(1.7, 1.7);
+    player.position = get_random_spawn_position(&regions, region, &random) - 0.5 * player.size;
+    player.texture = the_game->art.white;
+    player.health = 10;
+    player.max_health = 10;
+    add_entity(&level.entities, player);
+    return true;
+}
+
+bool convert_level_image(const char* image_path)
+{
+    int stem_length = (int) strlen(image_path);
+    const char* dot = strrchr(image_path, '.');
+    if (dot && !strchr(dot, '/') && !strchr(dot, '\\'))
+    {
+        stem_length = (int)(dot - image_path);
+    }
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%.*s%s", stem_length, image_path, LEVEL_FILE_EXTENSION);
+
+    if (!load_level_from_image(image_path)) return false;
+    if (!place_level_image_player(image_path)) return false;
+    return save_level_file(path);
+}
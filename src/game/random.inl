@@ -0,0 +1,70 @@
+// PCG32 (pcg-random.org). A Random is the whole state, so every system, level and thread can have its own,
+// and the same seed and stream always give the same numbers. Different streams with the same seed are
+// independent of each other.
+struct Random
+{
+    uint64 state;
+    uint64 increment;
+};
+
+inline uint32 next_random(Random* random)
+{
+    uint64 old = random->state;
+    random->state = old * 6364136223846793005ULL + random->increment;
+    uint32 shifted = (uint32)(((old >> 18) ^ old) >> 27);
+    uint32 rotation = (uint32)(old >> 59);
+    return (shifted >> rotation) | (shifted << ((-rotation) & 31));
+}
+
+Random seed_random(uint64 seed, uint64 stream = 0)
+{
+    Random random;
+    random.state = 0;
+    random.increment = (stream << 1) | 1;
+    next_random(&random);
+    random.state += seed;
+    next_random(&random);
+    return random;
+}
+
+inline uint64 next_random64(Random* random)
+{
+    uint64 high = next_random(random);
+    return (high << 32) | next_random(random);
+}
+
+// In [0, max).
+inline int random_int(Random* random, int max)
+{
+    return (int)(((uint64) next_random(random) * (uint32) max) >> 32);
+}
+
+// In [0, 1).
+inline float random_float(Random* random)
+{
+    return (float)(next_random(random) >> 8) * (1.0f / 16777216.0f);
+}
+
+void random_floats(Random* random, float* floats, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        floats[i] = random_float(random);
+    }
+}
+
+// Counter based, the same seed and coordinates always give the same number no matter in which order or on
+// which thread they're asked for.
+inline uint32 random_at(uint64 seed, int x, int y)
+{
+    uint64 z = seed + (uint32) x * 0x9E3779B97F4A7C15ULL + (uint32) y * 0xC2B2AE3D27D4EB4FULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return (uint32)((z ^ (z >> 31)) >> 32);
+}
+
+// In [0, 1).
+inline float random_float_at(uint64 seed, int x, int y)
+{
+    return (float)(random_at(seed, x, y) >> 8) * (1.0f / 16777216.0f);
+}
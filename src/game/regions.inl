@@ -0,0 +1,155 @@
+// Spawn cells are the tiles where a free 2x2 block of tiles starts, which is room for anything up to 2
+// tiles wide. Two neighboring spawn cells make a free 3x2 or 2x3 block, so such an entity can always move
+// from one to the other, and every spawn cell in a region can reach every other one.
+//
+// Regions are found with one union find pass over the spawn cells, and each region keeps a list of its
+// cells, so placing something reachable is a single random pick instead of sampling until a spot fits.
+struct Spawn_Regions
+{
+    int width;
+    int region_count;
+
+    // The cells of region r are cells[region_start[r]] up to cells[region_start[r + 1]], as y * width + x
+    // in row order.
+    std::vector<int> region_start;
+    std::vector<int> cells;
+
+    // The region of the spawn cell at every tile, -1 where there isn't one.
+    std::vector<int> labels;
+};
+
+static int find_region_root(std::vector<int>& parents, int label)
+{
+    while (parents[label] != label)
+    {
+        parents[label] = parents[parents[label]];
+        label = parents[label];
+    }
+    return label;
+}
+
+void find_spawn_regions(Bit_Grid* solid, Spawn_Regions* regions)
+{
+    int width = solid->width;
+    int height = solid->height;
+    regions->width = width;
+    regions->region_count = 0;
+    regions->region_start.clear();
+    regions->cells.clear();
+    regions->labels.assign(width * height, -1);
+
+    // Provisional labels first, which are turned into regions at the end.
+    std::vector<int>& labels = regions->labels;
+    std::vector<int> parents;
+
+    // A spawn cell has this tile, the one right of it and the two above open. The right neighbors of a
+    // word's cells are the word shifted down, with the lowest bit of the next word coming in at the top.
+    for (int y = 0; y < height - 1; y++)
+    {
+        uint64* row = get_bit_row(solid, y);
+        uint64* above = get_bit_row(solid, y + 1);
+        for (int word = 0; word < solid->stride; word++)
+        {
+            uint64 open = ~row[word] & ~above[word];
+            uint64 next = (word + 1 < solid->stride) ? (~row[word + 1] & ~above[word + 1]) : 0;
+            uint64 right = (open >> 1) | (next << 63);
+
+            // The last column has no right neighbor, and the padding bits are zero so they count as open.
+            uint64 cells = open & right & get_bit_row_mask(solid, word);
+            if (word * 64 + 64 >= width)
+            {
+                cells &= ~((uint64) 1 << ((width - 1) & 63));
+            }
+
+            while (cells)
+            {
+                int x = word * 64 + find_lowest_bit(cells);
+                cells &= cells - 1;
+
+                int index = y * width + x;
+                int left  = (x > 0) ? labels[index - 1] : -1;
+                int below = (y > 0) ? labels[index - width] : -1;
+
+                if (left < 0 && below < 0)
+                {
+                    labels[index] = (int) parents.size();
+                    parents.push_back(labels[index]);
+                }
+                else if (below < 0)
+                {
+                    labels[index] = left;
+                }
+                else
+                {
+                    labels[index] = below;
+                    if (left >= 0)
+                    {
+                        int left_root = find_region_root(parents, left);
+                        int below_root = find_region_root(parents, below);
+                        parents[max_i32(left_root, below_root)] = min_i32(left_root, below_root);
+                    }
+                }
+            }
+        }
+    }
+
+    // Number the roots in the order they were first seen, then bucket the cells by region.
+    std::vector<int> region_of_label(parents.size());
+    for (int label = 0; label < (int) parents.size(); label++)
+    {
+        int root = find_region_root(parents, label);
+        region_of_label[label] = (root == label) ? regions->region_count++ : region_of_label[root];
+    }
+
+    regions->region_start.assign(regions->region_count + 1, 0);
+    for (int index = 0; index < width * height; index++)
+    {
+        if (labels[index] >= 0)
+        {
+            int region = region_of_label[labels[index]];
+            labels[index] = region;
+            regions->region_start[region + 1]++;
+        }
+    }
+
+    for (int region = 0; region < regions->region_count; region++)
+    {
+        regions->region_start[region + 1] += regions->region_start[region];
+    }
+
+    std::vector<int> fill(regions->region_start.begin(), regions->region_start.end() - 1);
+    regions->cells.resize(regions->region_start[regions->region_count]);
+    for (int index = 0; index < width * height; index++)
+    {
+        if (labels[index] >= 0)
+        {
+            regions->cells[fill[labels[index]]++] = index;
+        }
+    }
+}
+
+inline int get_region_size(Spawn_Regions* regions, int region)
+{
+    return regions->region_start[region + 1] - regions->region_start[region];
+}
+
+// Returns -1 when there are no spawn cells at all.
+int find_largest_region(Spawn_Regions* regions)
+{
+    int largest = -1;
+    for (int region = 0; region < regions->region_count; region++)
+    {
+        if (largest < 0 || get_region_size(regions, region) > get_region_size(regions, largest))
+        {
+            largest = region;
+        }
+    }
+    return largest;
+}
+
+// The center of the 2x2 block of a random spawn cell in the region.
+Vector2 get_random_spawn_position(Spawn_Regions* regions, int region, Random* random)
+{
+    int cell = regions->cells[regions->region_start[region] + random_int(random, get_region_size(regions, region))];
+    return vector2(cell % regions->width + 1, cell / regions->width + 1);
+}
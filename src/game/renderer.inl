@@ -88,6 +88,79 @@ doesnt_fit:;
 
 
 
+// Build with RENDERER_COMPACT_VERTICES=1 for the packed vertex layout. Every vertex is written and
+// uploaded once per frame, so the layout size is directly the vertex bandwidth:
+//
+//     layout    position   uv            color         bytes/vertex   bytes/quad
+//     float     float2     float2        float4        32             128
+//     compact   float2     unorm16 x2    unorm8 x4     16              64
+//
+// A 64x64 level pushes at least 20480 quads per frame (4 per tile plus the stones overlay), so that's
+// 2.5 MB vs 1.25 MB before counting entities and UI. The compact layout clamps colors to [0, 1],
+// anything brighter than white renders as white.
+//
+// In instanced mode a quad is a single Sprite_Instance instead of four vertices, 48 bytes with the float
+// layout and 28 bytes with the compact one.
+#ifndef RENDERER_COMPACT_VERTICES
+#define RENDERER_COMPACT_VERTICES 0
+#endif
+
+#if RENDERER_COMPACT_VERTICES
+
+struct Vertex
+{
+    Vector2 position;
+    uint16 uv[2];
+    uint8 color[4];
+};
+
+uint16 pack_unorm16(float x) { return (uint16)(clamp_f32(x, 0, 1) * 65535.0f + 0.5f); }
+uint8  pack_unorm8 (float x) { return (uint8) (clamp_f32(x, 0, 1) *   255.0f + 0.5f); }
+
+Vertex make_vertex(float x, float y, float u, float v, Vector4 color)
+{
+    Vertex vertex;
+    vertex.position = { x, y };
+    vertex.uv[0] = pack_unorm16(u);
+    vertex.uv[1] = pack_unorm16(v);
+    vertex.color[0] = pack_unorm8(color.r);
+    vertex.color[1] = pack_unorm8(color.g);
+    vertex.color[2] = pack_unorm8(color.b);
+    vertex.color[3] = pack_unorm8(color.a);
+    return vertex;
+}
+
+struct Sprite_Instance
+{
+    Vector2 position;
+    Vector2 size;
+    uint16 uv[4];
+    uint8 color[4];
+};
+
+Sprite_Instance make_instance(float x, float y, float width, float height,
+                              float u1, float v1, float u2, float v2, Vector4 color)
+{
+    Sprite_Instance instance;
+    instance.position = { x, y };
+    instance.size = { width, height };
+    instance.uv[0] = pack_unorm16(u1);
+    instance.uv[1] = pack_unorm16(v1);
+    instance.uv[2] = pack_unorm16(u2);
+    instance.uv[3] = pack_unorm16(v2);
+    instance.color[0] = pack_unorm8(color.r);
+    instance.color[1] = pack_unorm8(color.g);
+    instance.color[2] = pack_unorm8(color.b);
+    instance.color[3] = pack_unorm8(color.a);
+    return instance;
+}
+
+#define VERTEX_UV_FORMAT    2, GL_UNSIGNED_SHORT, true
+#define VERTEX_COLOR_FORMAT 4, GL_UNSIGNED_BYTE,  true
+#define INSTANCE_UV_FORMAT  4, GL_UNSIGNED_SHORT, true
+
+#else
+
 struct Vertex
 {
     Vector2 position;
@@ -95,31 +168,167 @@ struct Vertex
     Vector4 color;
 };
 
+Vertex make_vertex(float x, float y, float u, float v, Vector4 color)
+{
+    return { { x, y }, { u, v }, color };
+}
+
+struct Sprite_Instance
+{
+    Vector2 position;
+    Vector2 size;
+    Vector4 uv;
+    Vector4 color;
+};
+
+Sprite_Instance make_instance(float x, float y, float width, float height,
+                              float u1, float v1, float u2, float v2, Vector4 color)
+{
+    return { { x, y }, { width, height }, { u1, v1, u2, v2 }, color };
+}
+
+#define VERTEX_UV_FORMAT    2, GL_FLOAT, false
+#define VERTEX_COLOR_FORMAT 4, GL_FLOAT, false
+#define INSTANCE_UV_FORMAT  4, GL_FLOAT, false
+
+#endif
+
+// Every quad is four consecutive vertices, so the index pattern never changes and lives in a static buffer
+// built by the renderer. Only vertices get uploaded.
 static std::vector<Vertex> render_vertices;
-static std::vector<uint32> render_indices;
+
+// When render_instanced is set, quads are pushed here instead and expanded in the vertex shader.
+static std::vector<Sprite_Instance> render_instances;
+static bool render_instanced;
+
+
+
+// Nothing is drawn while the frame is being built. Pushed quads are recorded as draw items, runs of quads
+// that share a sort key, and render_frame sorts all items by key at the end of the frame and issues as few
+// draw calls as it can. Layers are the only ordering guarantee: within a layer, items are grouped by
+// camera, blend mode and texture, and submission order is only kept between items with the same state.
+enum Render_Layer
+{
+    LAYER_TILES,
+    LAYER_TILE_DETAIL,
+    LAYER_ENTITIES,
+    LAYER_SHADOWS,
+    LAYER_UI,
+    LAYER_RHYTHM,
+};
+
+enum Blend_Mode
+{
+    BLEND_NONE,
+    BLEND_ALPHA,
+    BLEND_MULTIPLY,
+};
+
+enum Texture_Id
+{
+    TEXTURE_ATLAS,
+    TEXTURE_SHADOW_MAP,
+};
+
+struct Static_Mesh;
+
+struct Draw_Item
+{
+    uint32 key;
+    int first_quad;
+    int quad_count;
+    Static_Mesh* mesh; // NULL for items made of pushed quads
+};
+
+// Most significant first: layer, camera, blend mode, texture.
+uint32 make_draw_key(Render_Layer layer, int camera, Blend_Mode blend, Texture_Id texture)
+{
+    return ((uint32) layer << 24) | ((uint32) camera << 16) | ((uint32) blend << 8) | (uint32) texture;
+}
+
+int        get_key_camera (uint32 key) { return (key >> 16) & 0xFF; }
+Blend_Mode get_key_blend  (uint32 key) { return (Blend_Mode)((key >> 8) & 0xFF); }
+Texture_Id get_key_texture(uint32 key) { return (Texture_Id)(key & 0xFF); }
+
+static std::vector<Draw_Item> render_items;
+static std::vector<Matrix4> render_cameras;
+
+static struct
+{
+    Render_Layer layer;
+    Blend_Mode blend;
+    Texture_Id texture;
+    int camera;
+    uint32 key;
+} render_state;
+
+static void update_render_key()
+{
+    render_state.key = make_draw_key(render_state.layer, render_state.camera, render_state.blend, render_state.texture);
+}
+
+void set_render_state(Render_Layer layer, Blend_Mode blend = BLEND_ALPHA, Texture_Id texture = TEXTURE_ATLAS)
+{
+    render_state.layer = layer;
+    render_state.blend = blend;
+    render_state.texture = texture;
+    update_render_key();
+}
+
+// Everything pushed after this is drawn with this transform, up to 256 cameras per frame.
+void set_camera(Matrix4 transform)
+{
+    if (render_cameras.size() >= 256) return;
+
+    render_state.camera = render_cameras.size();
+    render_cameras.push_back(transform);
+    update_render_key();
+}
+
+static int get_pending_quad_count()
+{
+    return render_instanced ? render_instances.size() : render_vertices.size() / 4;
+}
+
+static void add_quad_to_items()
+{
+    int quad = get_pending_quad_count() - 1;
+
+    if (!render_items.empty())
+    {
+        Draw_Item* last = &render_items.back();
+        if (!last->mesh && last->key == render_state.key && last->first_quad + last->quad_count == quad)
+        {
+            last->quad_count++;
+            return;
+        }
+    }
+
+    render_items.push_back({ render_state.key, quad, 1, NULL });
+}
 
 void push_rectangle(float x, float y, float width, float height,
                     float u1, float v1, float u2, float v2,
                     Vector4 color)
 {
-    float x1 = x;
-    float x2 = x + width;
-    float y1 = y;
-    float y2 = y + height;
-
-    uint32 base_index = render_vertices.size();
+    if (render_instanced)
+    {
+        render_instances.push_back(make_instance(x, y, width, height, u1, v1, u2, v2, color));
+    }
+    else
+    {
+        float x1 = x;
+        float x2 = x + width;
+        float y1 = y;
+        float y2 = y + height;
 
-    render_vertices.push_back({ { x1, y1 }, { u1, v1 }, color });
-    render_vertices.push_back({ { x2, y1 }, { u2, v1 }, color });
-    render_vertices.push_back({ { x2, y2 }, { u2, v2 }, color });
-    render_vertices.push_back({ { x1, y2 }, { u1, v2 }, color });
+        render_vertices.push_back(make_vertex(x1, y1, u1, v1, color));
+        render_vertices.push_back(make_vertex(x2, y1, u2, v1, color));
+        render_vertices.push_back(make_vertex(x2, y2, u2, v2, color));
+        render_vertices.push_back(make_vertex(x1, y2, u1, v2, color));
+    }
 
-    render_indices.push_back(base_index + 0);
-    render_indices.push_back(base_index + 1);
-    render_indices.push_back(base_index + 2);
-    render_indices.push_back(base_index + 0);
-    render_indices.push_back(base_index + 2);
-    render_indices.push_back(base_index + 3);
+    add_quad_to_items();
 }
 
 void push_rectangle(float x, float y, float width, float height, Texture texture, Vector4 color = { 1, 1, 1, 1 })
@@ -141,23 +350,479 @@ void push_centered_rectangle(Vector2 position, Vector2 size, Texture texture, Ve
 
 
 
+// How the per-frame vertex data gets to the GPU.
+enum Buffer_Mode
+{
+    BUFFER_REALLOCATE,  // glBufferData on every upload, the driver reallocates storage each time
+    BUFFER_ORPHAN,      // one big buffer sub-allocated with unsynchronized maps, orphaned when it fills up
+    BUFFER_PERSISTENT,  // persistently mapped ring buffer, fenced per segment (needs ARB_buffer_storage)
+
+    BUFFER_MODE_COUNT,
+};
+
+const char* BUFFER_MODE_NAMES[BUFFER_MODE_COUNT] = { "reallocate", "orphan", "persistent" };
+
+const int    STREAM_SEGMENT_COUNT = 3;
+const uint32 STREAM_SEGMENT_SIZE  = 8 * 1024 * 1024;
+const uint32 STREAM_ALIGNMENT     = 64;
+
+// 16-bit indices can address 65536 vertices, bigger batches are drawn in several pieces.
+const int MAX_QUADS_PER_DRAW = 65536 / 4;
+
+struct Stream_Buffer
+{
+    GLuint buffer;
+    uint32 size;
+    uint32 cursor;
+
+    // Persistent mode only. segment is the one being filled, cursor can be right at its end.
+    uint8* mapped;
+    int segment;
+    GLsync fences[STREAM_SEGMENT_COUNT];
+};
+
+struct Render_Stats
+{
+    uint64 bytes_uploaded;
+    int draw_items;
+    int draw_calls;
+
+    // GL state calls that were actually issued vs. the ones skipped because the state was already set.
+    int state_changes;
+    int redundant_state_changes;
+};
+
+struct Shader
+{
+    GLuint program;
+    GLint transform_location;
+    GLint atlas_location;
+
+    bool has_transform;
+    Matrix4 transform;
+};
+
+// Mirror of the GL state the renderer touches, so redundant binds can be skipped. Anything that binds
+// these behind the renderer's back has to go through the bind_* functions below, or the cache lies.
+struct Bound_State
+{
+    GLuint program;
+    GLuint texture;
+    GLuint vao;
+    GLuint array_buffer;
+    Blend_Mode blend;
+};
+
+// Single channel texture drawn as black with the texel value as alpha. The CPU copy is kept around so
+// only the dirty rectangle has to be recomputed and re-uploaded when the level changes.
+struct Shadow_Map
+{
+    GLuint texture;
+    int width;
+    int height;
+    uint8* pixels;
+
+    bool dirty;
+    int dirty_min_x;
+    int dirty_min_y;
+    int dirty_max_x;
+    int dirty_max_y;
+};
+
+enum Render_Backend
+{
+    RENDER_OPENGL,
+    RENDER_SOFTWARE, // rasterizes on the CPU, see software_renderer.inl
+};
+
+struct Software_Renderer;
+
 struct Renderer
 {
+    // Chosen by the game before init_renderer. With RENDER_SOFTWARE no GL calls are made at all.
+    Render_Backend backend;
+    Software_Renderer* software;
+
     Atlas atlas;
 
-    GLuint shader;
+    Shader shader;
+    Shader instance_shader;
     GLuint atlas_texture;
     GLuint vao;
+    GLuint instance_vao;
     GLuint vbo;
     GLuint ibo;
+    int quad_index_capacity;
+
+    Buffer_Mode buffer_mode;
+    Stream_Buffer orphan_stream;
+    Stream_Buffer persistent_stream;
+    bool persistent_supported;
 
-    Matrix4 camera_transform;
+    Shadow_Map shadow_map;
+
+    Bound_State bound;
+    Render_Stats stats;
+    Render_Stats last_frame_stats;
+
+    // Size of the view of the most recent set_camera, in world units. Set by the game.
     float camera_width;
     float camera_height;
 };
 
+void init_software_renderer(Renderer* renderer);
+void software_set_viewport(Renderer* renderer, int width, int height, uint32* pixels);
+void software_clear(Renderer* renderer, Vector4 color);
+void software_render_frame(Renderer* renderer);
+
+void bind_array_buffer(Renderer* renderer, GLuint buffer);
+
+static void init_stream_buffers(Renderer* renderer)
+{
+    Stream_Buffer* orphan = &renderer->orphan_stream;
+    orphan->size = STREAM_SEGMENT_SIZE;
+    glGenBuffers(1, &orphan->buffer);
+    bind_array_buffer(renderer, orphan->buffer);
+    glBufferData(GL_ARRAY_BUFFER, orphan->size, NULL, GL_STREAM_DRAW);
+
+    renderer->persistent_supported = GLEW_ARB_buffer_storage;
+    if (renderer->persistent_supported)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+        Stream_Buffer* persistent = &renderer->persistent_stream;
+        persistent->size = STREAM_SEGMENT_SIZE * STREAM_SEGMENT_COUNT;
+        glGenBuffers(1, &persistent->buffer);
+        bind_array_buffer(renderer, persistent->buffer);
+        glBufferStorage(GL_ARRAY_BUFFER, persistent->size, NULL, flags);
+        persistent->mapped = (uint8*) glMapBufferRange(GL_ARRAY_BUFFER, 0, persistent->size, flags);
+    }
+
+    renderer->buffer_mode = renderer->persistent_supported ? BUFFER_PERSISTENT : BUFFER_ORPHAN;
+}
+
+static bool count_state_change(Renderer* renderer, bool changed)
+{
+    if (changed) renderer->stats.state_changes++;
+    else         renderer->stats.redundant_state_changes++;
+    return changed;
+}
+
+void bind_program(Renderer* renderer, GLuint program)
+{
+    if (!count_state_change(renderer, renderer->bound.program != program)) return;
+    glUseProgram(program);
+    renderer->bound.program = program;
+}
+
+void bind_texture(Renderer* renderer, GLuint texture)
+{
+    if (!count_state_change(renderer, renderer->bound.texture != texture)) return;
+    glBindTexture(GL_TEXTURE_2D, texture);
+    renderer->bound.texture = texture;
+}
+
+void bind_vertex_array(Renderer* renderer, GLuint vao)
+{
+    if (!count_state_change(renderer, renderer->bound.vao != vao)) return;
+    glBindVertexArray(vao);
+    renderer->bound.vao = vao;
+}
+
+void bind_array_buffer(Renderer* renderer, GLuint buffer)
+{
+    if (!count_state_change(renderer, renderer->bound.array_buffer != buffer)) return;
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    renderer->bound.array_buffer = buffer;
+}
+
+void set_blend_mode(Renderer* renderer, Blend_Mode blend)
+{
+    if (!count_state_change(renderer, renderer->bound.blend != blend)) return;
+
+    if (blend == BLEND_NONE)
+    {
+        glDisable(GL_BLEND);
+    }
+    else
+    {
+        if (renderer->bound.blend == BLEND_NONE) glEnable(GL_BLEND);
+        if (blend == BLEND_ALPHA)    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        if (blend == BLEND_MULTIPLY) glBlendFunc(GL_DST_COLOR, GL_ZERO);
+    }
+
+    renderer->bound.blend = blend;
+}
+
+void set_transform(Renderer* renderer, Shader* shader, Matrix4* transform)
+{
+    bool changed = !shader->has_transform || memcmp(&shader->transform, transform, sizeof(Matrix4));
+    if (!count_state_change(renderer, changed)) return;
+
+    bind_program(renderer, shader->program);
+    glUniformMatrix4fv(shader->transform_location, 1, true, transform->e);
+    shader->has_transform = true;
+    shader->transform = *transform;
+}
+
+void delete_texture(Renderer* renderer, GLuint* texture)
+{
+    // GL unbinds deleted textures, and the name can be handed out again by glGenTextures.
+    if (renderer->bound.texture == *texture)
+    {
+        renderer->bound.texture = 0;
+    }
+
+    glDeleteTextures(1, texture);
+    *texture = 0;
+}
+
+static GLuint get_texture(Renderer* renderer, Texture_Id texture)
+{
+    if (texture == TEXTURE_SHADOW_MAP) return renderer->shadow_map.texture;
+    return renderer->atlas_texture;
+}
+
+static void wait_for_fence(GLsync* fence)
+{
+    if (!*fence) return;
+
+    while (true)
+    {
+        GLenum result = glClientWaitSync(*fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED) break;
+        if (result == GL_WAIT_FAILED) break;
+    }
+
+    glDeleteSync(*fence);
+    *fence = NULL;
+}
+
+// Moves the persistent ring on to the next segment if size more bytes don't fit in the current one, and
+// returns the segment that was finished, or -1 if it didn't move. The segment is tracked on its own
+// because an allocation can end exactly at the end of one, and then the cursor alone would point at the
+// next segment before it has been waited for.
+static int advance_stream_segment(Stream_Buffer* stream, uint32 size)
+{
+    uint32 segment_end = (stream->segment + 1) * STREAM_SEGMENT_SIZE;
+    if (stream->cursor + size <= segment_end) return -1;
+
+    int finished = stream->segment;
+    stream->segment = (stream->segment + 1) % STREAM_SEGMENT_COUNT;
+    stream->cursor = stream->segment * STREAM_SEGMENT_SIZE;
+    return finished;
+}
+
+// Returns CPU-writable memory for size bytes of the current stream buffer, and the offset of that memory
+// inside the buffer. Returns NULL if the current mode can't fit the request, the caller falls back to
+// BUFFER_REALLOCATE then. Every successful call must be followed by stream_commit.
+static uint8* stream_allocate(Renderer* renderer, uint32 size, uint32* offset)
+{
+    size = (size + STREAM_ALIGNMENT - 1) & ~(STREAM_ALIGNMENT - 1);
+
+    if (renderer->buffer_mode == BUFFER_ORPHAN)
+    {
+        Stream_Buffer* stream = &renderer->orphan_stream;
+        bind_array_buffer(renderer, stream->buffer);
+
+        if (stream->cursor + size > stream->size)
+        {
+            // Orphan the old storage. The driver keeps it alive until the GPU is done with it.
+            while (stream->size < size) stream->size *= 2;
+            glBufferData(GL_ARRAY_BUFFER, stream->size, NULL, GL_STREAM_DRAW);
+            stream->cursor = 0;
+        }
+
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+        uint8* memory = (uint8*) glMapBufferRange(GL_ARRAY_BUFFER, stream->cursor, size, flags);
+
+        *offset = stream->cursor;
+        stream->cursor += size;
+        return memory;
+    }
+
+    if (renderer->buffer_mode == BUFFER_PERSISTENT)
+    {
+        Stream_Buffer* stream = &renderer->persistent_stream;
+        if (size > STREAM_SEGMENT_SIZE) return NULL;
+
+        int finished = advance_stream_segment(stream, size);
+        if (finished >= 0)
+        {
+            // Everything drawn from the finished segment is fenced, and we wait until the GPU is
+            // done reading the next segment before we start overwriting it.
+            stream->fences[finished] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            wait_for_fence(&stream->fences[stream->segment]);
+        }
+
+        *offset = stream->cursor;
+        stream->cursor += size;
+        return stream->mapped + *offset;
+    }
+
+    return NULL;
+}
+
+static void stream_commit(Renderer* renderer)
+{
+    if (renderer->buffer_mode == BUFFER_ORPHAN)
+    {
+        bind_array_buffer(renderer, renderer->orphan_stream.buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+}
+
+static GLuint get_stream_buffer(Renderer* renderer)
+{
+    if (renderer->buffer_mode == BUFFER_ORPHAN)     return renderer->orphan_stream.buffer;
+    if (renderer->buffer_mode == BUFFER_PERSISTENT) return renderer->persistent_stream.buffer;
+    return renderer->vbo;
+}
+
+static void ensure_quad_indices(Renderer* renderer, int quad_count)
+{
+    quad_count = min_i32(quad_count, MAX_QUADS_PER_DRAW);
+    if (quad_count <= renderer->quad_index_capacity) return;
+
+    int capacity = max_i32(renderer->quad_index_capacity, 1024);
+    while (capacity < quad_count) capacity *= 2;
+    capacity = min_i32(capacity, MAX_QUADS_PER_DRAW);
+
+    std::vector<uint16> indices(capacity * 6);
+    for (int quad = 0; quad < capacity; quad++)
+    {
+        uint16 base = quad * 4;
+        uint16* index = &indices[quad * 6];
+        index[0] = base + 0;
+        index[1] = base + 1;
+        index[2] = base + 2;
+        index[3] = base + 0;
+        index[4] = base + 2;
+        index[5] = base + 3;
+    }
+
+    // The element buffer binding is VAO state, so this only has to happen once per resize.
+    bind_vertex_array(renderer, renderer->vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, renderer->ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint16), &indices[0], GL_STATIC_DRAW);
+
+    renderer->quad_index_capacity = capacity;
+}
+
+void set_buffer_mode(Renderer* renderer, Buffer_Mode mode)
+{
+    if (mode == BUFFER_PERSISTENT && !renderer->persistent_supported)
+    {
+        mode = BUFFER_REALLOCATE;
+    }
+
+    renderer->buffer_mode = mode;
+}
+
+void set_instanced(bool instanced)
+{
+    render_instanced = instanced;
+}
+
+void begin_frame(Renderer* renderer)
+{
+    renderer->last_frame_stats = renderer->stats;
+    renderer->stats = {};
+
+    render_vertices.clear();
+    render_instances.clear();
+    render_items.clear();
+    render_cameras.clear();
+
+    render_state = {};
+    set_camera(identity());
+    set_render_state(LAYER_UI);
+}
+
+// pixels is where the software backend renders to, it uses its own buffer if it's NULL. The GL backend
+// always renders to the window.
+void set_viewport(Renderer* renderer, int width, int height, uint32* pixels = NULL)
+{
+    if (renderer->backend == RENDER_SOFTWARE)
+    {
+        software_set_viewport(renderer, width, height, pixels);
+        return;
+    }
+
+    glViewport(0, 0, width, height);
+}
+
+// Clears right away, not as part of the render queue.
+void clear_frame(Renderer* renderer, Vector4 color)
+{
+    if (renderer->backend == RENDER_SOFTWARE)
+    {
+        software_clear(renderer, color);
+        return;
+    }
+
+    glClearColor(color.r, color.g, color.b, color.a);
+    glClear(GL_COLOR_BUFFER_BIT);
+}
+
+void print_render_stats(Renderer* renderer)
+{
+    Render_Stats* stats = &renderer->last_frame_stats;
+    if (renderer->backend == RENDER_SOFTWARE)
+    {
+        printf("software renderer, %s, %d draw items\n", render_instanced ? "instanced" : "vertices", stats->draw_items);
+        return;
+    }
+
+    printf("buffer mode: %s, %s, %d bytes per quad\n", BUFFER_MODE_NAMES[renderer->buffer_mode],
+           render_instanced ? "instanced" : "vertices",
+           render_instanced ? (int) sizeof(Sprite_Instance) : (int)(4 * sizeof(Vertex)));
+    printf("    uploaded %.1f KB, %d draw items in %d draw calls\n",
+           stats->bytes_uploaded / 1024.0, stats->draw_items, stats->draw_calls);
+    printf("    %d state changes, %d redundant ones skipped\n",
+           stats->state_changes, stats->redundant_state_changes);
+}
+
+static Shader compile_shader(const char* vs_source, const char* fs_source)
+{
+    GLuint vs = glCreateShader(GL_VERTEX_SHADER);
+    GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(vs, 1, &vs_source, NULL);
+    glShaderSource(fs, 1, &fs_source, NULL);
+    glCompileShader(vs);
+    glCompileShader(fs);
+
+    GLuint shader = glCreateProgram();
+    glAttachShader(shader, vs);
+    glAttachShader(shader, fs);
+    glLinkProgram(shader);
+
+    glDetachShader(shader, vs);
+    glDetachShader(shader, fs);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+
+    Shader result = {};
+    result.program = shader;
+    result.transform_location = glGetUniformLocation(shader, "transform");
+    result.atlas_location = glGetUniformLocation(shader, "atlas");
+
+    // Everything samples from texture unit 0.
+    glUseProgram(shader);
+    glUniform1i(result.atlas_location, 0);
+    glUseProgram(0);
+
+    return result;
+}
+
 void init_renderer(Renderer* renderer)
 {
+    if (renderer->backend == RENDER_SOFTWARE)
+    {
+        init_software_renderer(renderer);
+        return;
+    }
+
     glGenVertexArrays(1, &renderer->vao);
     glBindVertexArray(renderer->vao);
 
@@ -168,12 +833,36 @@ void init_renderer(Renderer* renderer)
     glEnableVertexAttribArray(1);
     glEnableVertexAttribArray(2);
 
-    glBindBuffer(GL_ARRAY_BUFFER, renderer->vbo);
-    glVertexAttribPointer(0, 2, GL_FLOAT, false, sizeof(Vertex), (void*) offsetof(Vertex, position));
-    glVertexAttribPointer(1, 2, GL_FLOAT, false, sizeof(Vertex), (void*) offsetof(Vertex, uv));
-    glVertexAttribPointer(2, 4, GL_FLOAT, false, sizeof(Vertex), (void*) offsetof(Vertex, color));
+    // The vertex format is separate from the buffer binding, so each flush only has to point binding 0
+    // at wherever its vertices ended up in the stream buffer.
+    glVertexAttribFormat(0, 2, GL_FLOAT, false, offsetof(Vertex, position));
+    glVertexAttribFormat(1, VERTEX_UV_FORMAT,    offsetof(Vertex, uv));
+    glVertexAttribFormat(2, VERTEX_COLOR_FORMAT, offsetof(Vertex, color));
+    glVertexAttribBinding(0, 0);
+    glVertexAttribBinding(1, 0);
+    glVertexAttribBinding(2, 0);
+
+    // Instances use the same binding with a divisor of 1, the quad corners come from gl_VertexID.
+    glGenVertexArrays(1, &renderer->instance_vao);
+    glBindVertexArray(renderer->instance_vao);
 
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+    glEnableVertexAttribArray(3);
+
+    glVertexAttribFormat(0, 2, GL_FLOAT, false, offsetof(Sprite_Instance, position));
+    glVertexAttribFormat(1, 2, GL_FLOAT, false, offsetof(Sprite_Instance, size));
+    glVertexAttribFormat(2, INSTANCE_UV_FORMAT,  offsetof(Sprite_Instance, uv));
+    glVertexAttribFormat(3, VERTEX_COLOR_FORMAT, offsetof(Sprite_Instance, color));
+    glVertexAttribBinding(0, 0);
+    glVertexAttribBinding(1, 0);
+    glVertexAttribBinding(2, 0);
+    glVertexAttribBinding(3, 0);
+    glVertexBindingDivisor(0, 1);
 
+    init_stream_buffers(renderer);
+    ensure_quad_indices(renderer, 4096);
 
     const char* vs_source =
         "#version 430\n"
@@ -201,63 +890,368 @@ void init_renderer(Renderer* renderer)
         "    pixel_color = texture(atlas, fragment_uv) * fragment_color;\n"
         "}\n";
 
-    GLuint vs = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(vs, 1, &vs_source, NULL);
-    glShaderSource(fs, 1, &fs_source, NULL);
-    glCompileShader(vs);
-    glCompileShader(fs);
-
-    GLuint shader = renderer->shader = glCreateProgram();
-    glAttachShader(shader, vs);
-    glAttachShader(shader, fs);
-    glLinkProgram(shader);
+    const char* instance_vs_source =
+        "#version 430\n"
+        "uniform mat4 transform;\n"
+        "layout(location = 0) in vec2 instance_position;\n"
+        "layout(location = 1) in vec2 instance_size;\n"
+        "layout(location = 2) in vec4 instance_uv;\n"
+        "layout(location = 3) in vec4 instance_color;\n"
+        "out vec2 fragment_uv;\n"
+        "out vec4 fragment_color;\n"
+        "void main()\n"
+        "{\n"
+        "    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);\n"
+        "    gl_Position = vec4(instance_position + corner * instance_size, 0, 1) * transform;\n"
+        "    fragment_uv = mix(instance_uv.xy, instance_uv.zw, corner);\n"
+        "    fragment_color = instance_color;\n"
+        "}\n";
 
-    glDetachShader(shader, vs);
-    glDetachShader(shader, fs);
-    glDeleteShader(vs);
-    glDeleteShader(fs);
+    renderer->shader = compile_shader(vs_source, fs_source);
+    renderer->instance_shader = compile_shader(instance_vs_source, fs_source);
 
 
     Atlas* atlas = &renderer->atlas;
     glGenTextures(1, &renderer->atlas_texture);
+    glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, renderer->atlas_texture);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, atlas->width, atlas->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, atlas->data);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glDisable(GL_BLEND);
+    renderer->bound = {};
+    renderer->bound.texture = renderer->atlas_texture;
 }
 
-void rendering_flush(Renderer* renderer, bool multiply = false)
+// Marks texels as needing a recompute and upload, the bounds are inclusive and get clipped to the map.
+void mark_shadow_map_dirty(Shadow_Map* map, int min_x, int min_y, int max_x, int max_y)
 {
-    glBindBuffer(GL_ARRAY_BUFFER, renderer->vbo);
-    glBufferData(GL_ARRAY_BUFFER, render_vertices.size() * sizeof(Vertex), &render_vertices[0], GL_STATIC_DRAW);
+    min_x = max_i32(min_x, 0);
+    min_y = max_i32(min_y, 0);
+    max_x = min_i32(max_x, map->width  - 1);
+    max_y = min_i32(max_y, map->height - 1);
+    if (min_x > max_x || min_y > max_y) return;
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, renderer->ibo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, render_indices.size() * sizeof(uint32), &render_indices[0], GL_STATIC_DRAW);
+    if (!map->dirty)
+    {
+        map->dirty = true;
+        map->dirty_min_x = min_x;
+        map->dirty_min_y = min_y;
+        map->dirty_max_x = max_x;
+        map->dirty_max_y = max_y;
+        return;
+    }
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, renderer->atlas_texture);
+    map->dirty_min_x = min_i32(map->dirty_min_x, min_x);
+    map->dirty_min_y = min_i32(map->dirty_min_y, min_y);
+    map->dirty_max_x = max_i32(map->dirty_max_x, max_x);
+    map->dirty_max_y = max_i32(map->dirty_max_y, max_y);
+}
 
-    GLuint shader = renderer->shader;
-    glUseProgram(shader);
-    GLint transform = glGetUniformLocation(shader, "transform");
-    GLint atlas = glGetUniformLocation(shader, "atlas");
-    glUniformMatrix4fv(transform, 1, true, renderer->camera_transform.e);
-    glUniform1i(atlas, 0);
+void resize_shadow_map(Renderer* renderer, int width, int height)
+{
+    Shadow_Map* map = &renderer->shadow_map;
+    free(map->pixels);
+    map->width = width;
+    map->height = height;
+    map->pixels = (uint8*) calloc(1, width * height);
+    map->dirty = false;
+    mark_shadow_map_dirty(map, 0, 0, width - 1, height - 1);
+
+    // The software backend samples the CPU copy directly.
+    if (renderer->backend == RENDER_SOFTWARE) return;
 
-    glEnable(GL_BLEND);
-    if (!multiply)
+    if (!map->texture)
     {
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glGenTextures(1, &map->texture);
+        bind_texture(renderer, map->texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+        GLint swizzle[] = { GL_ZERO, GL_ZERO, GL_ZERO, GL_RED };
+        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    }
+
+    bind_texture(renderer, map->texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, map->pixels);
+}
+
+// Uploads the dirty rectangle of the CPU copy, the caller is expected to have recomputed it already.
+void upload_shadow_map(Renderer* renderer)
+{
+    Shadow_Map* map = &renderer->shadow_map;
+    if (!map->dirty) return;
+
+    if (renderer->backend == RENDER_SOFTWARE)
+    {
+        map->dirty = false;
+        return;
+    }
+
+    int width = map->dirty_max_x - map->dirty_min_x + 1;
+    int height = map->dirty_max_y - map->dirty_min_y + 1;
+    uint8* first = map->pixels + map->dirty_min_y * map->width + map->dirty_min_x;
+
+    bind_texture(renderer, map->texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, map->width);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, map->dirty_min_x, map->dirty_min_y, width, height, GL_RED, GL_UNSIGNED_BYTE, first);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+    renderer->stats.bytes_uploaded += width * height;
+    map->dirty = false;
+}
+
+static uint32 get_quad_bytes(bool instanced)
+{
+    return instanced ? sizeof(Sprite_Instance) : 4 * sizeof(Vertex);
+}
+
+static void draw_quads(Renderer* renderer, GLuint buffer, uint32 offset, int quad_count, bool instanced, uint32 key)
+{
+    if (!instanced)
+    {
+        ensure_quad_indices(renderer, quad_count);
+    }
+
+    Shader* shader = instanced ? &renderer->instance_shader : &renderer->shader;
+    bind_texture(renderer, get_texture(renderer, get_key_texture(key)));
+    bind_program(renderer, shader->program);
+    set_transform(renderer, shader, &render_cameras[get_key_camera(key)]);
+    set_blend_mode(renderer, get_key_blend(key));
+
+    if (instanced)
+    {
+        bind_vertex_array(renderer, renderer->instance_vao);
+        glBindVertexBuffer(0, buffer, offset, sizeof(Sprite_Instance));
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, quad_count);
+        renderer->stats.draw_calls++;
     }
     else
     {
-        glBlendFunc(GL_DST_COLOR, GL_ZERO);
+        bind_vertex_array(renderer, renderer->vao);
+        for (int first_quad = 0; first_quad < quad_count; first_quad += MAX_QUADS_PER_DRAW)
+        {
+            int draw_quads = min_i32(quad_count - first_quad, MAX_QUADS_PER_DRAW);
+            glBindVertexBuffer(0, buffer, offset + first_quad * 4 * sizeof(Vertex), sizeof(Vertex));
+            glDrawElements(GL_TRIANGLES, draw_quads * 6, GL_UNSIGNED_SHORT, 0);
+            renderer->stats.draw_calls++;
+        }
     }
+}
 
-    glBindVertexArray(renderer->vao);
-    glDrawElements(GL_TRIANGLES, render_indices.size(), GL_UNSIGNED_INT, 0);
+
+
+// Quads that stay the same for many frames. Quads pushed between begin_bake and bake_mesh don't become
+// draw items, they are moved into the mesh's own GPU buffer instead. submit_mesh then queues the whole
+// mesh as one draw item without uploading anything.
+struct Static_Mesh
+{
+    GLuint buffer;
+    uint8* data; // the software backend keeps the quads in memory instead
+    int quad_count;
+    bool instanced;
+};
+
+static int render_bake_first_quad;
+static int render_bake_first_item;
+
+void begin_bake()
+{
+    render_bake_first_quad = get_pending_quad_count();
+    render_bake_first_item = render_items.size();
+}
+
+void bake_mesh(Renderer* renderer, Static_Mesh* mesh)
+{
+    int first = render_bake_first_quad;
+    mesh->quad_count = get_pending_quad_count() - first;
+    mesh->instanced = render_instanced;
+
+    uint32 bytes = mesh->quad_count * get_quad_bytes(mesh->instanced);
+    void* data = mesh->instanced ? (void*)(render_instances.data() + first) : (void*)(render_vertices.data() + first * 4);
+
+    if (renderer->backend == RENDER_SOFTWARE)
+    {
+        mesh->data = (uint8*) realloc(mesh->data, bytes);
+        memcpy(mesh->data, data, bytes);
+    }
+    else
+    {
+        if (!mesh->buffer)
+        {
+            glGenBuffers(1, &mesh->buffer);
+        }
+
+        bind_array_buffer(renderer, mesh->buffer);
+        glBufferData(GL_ARRAY_BUFFER, bytes, data, GL_STATIC_DRAW);
+        renderer->stats.bytes_uploaded += bytes;
+    }
+
+    render_instances.resize(render_instanced ? first : 0);
+    render_vertices.resize(render_instanced ? 0 : first * 4);
+    render_items.resize(render_bake_first_item);
+    begin_bake();
+}
+
+void free_mesh(Renderer* renderer, Static_Mesh* mesh)
+{
+    if (mesh->buffer)
+    {
+        // Same as delete_texture, GL unbinds the buffer and the name can come back from glGenBuffers.
+        if (renderer->bound.array_buffer == mesh->buffer)
+        {
+            renderer->bound.array_buffer = 0;
+        }
+
+        glDeleteBuffers(1, &mesh->buffer);
+    }
+
+    free(mesh->data);
+    *mesh = {};
+}
+
+void submit_mesh(Static_Mesh* mesh)
+{
+    if (!mesh->quad_count) return;
+    render_items.push_back({ render_state.key, 0, mesh->quad_count, mesh });
+}
+
+
+
+// LSD radix sort on the key, one byte per pass. It's stable, which is what keeps submission order within
+// a key. Passes where every item has the same byte are skipped, usually that's most of them.
+static void sort_draw_items(std::vector<Draw_Item>* items)
+{
+    static std::vector<Draw_Item> scratch;
+    scratch.resize(items->size());
+
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        int counts[256] = {};
+        for (Draw_Item& item : *items)
+        {
+            counts[(item.key >> shift) & 0xFF]++;
+        }
+
+        if (counts[((*items)[0].key >> shift) & 0xFF] == (int) items->size())
+        {
+            continue;
+        }
+
+        int offsets[256];
+        int total = 0;
+        for (int digit = 0; digit < 256; digit++)
+        {
+            offsets[digit] = total;
+            total += counts[digit];
+        }
+
+        for (Draw_Item& item : *items)
+        {
+            scratch[offsets[(item.key >> shift) & 0xFF]++] = item;
+        }
+
+        items->swap(scratch);
+    }
+}
+
+// Draws everything queued this frame.
+void render_frame(Renderer* renderer)
+{
+    static std::vector<uint8> fallback;
+
+    renderer->stats.draw_items += render_items.size();
+    if (render_items.empty()) return;
+
+    sort_draw_items(&render_items);
+
+    if (renderer->backend == RENDER_SOFTWARE)
+    {
+        software_render_frame(renderer);
+        render_vertices.clear();
+        render_instances.clear();
+        render_items.clear();
+        return;
+    }
+
+    // Pushed quads are uploaded in sorted order, so items that end up next to each other with the same
+    // key are also next to each other in the buffer and can be drawn with one call.
+    uint32 quad_bytes = get_quad_bytes(render_instanced);
+    uint32 total_bytes = get_pending_quad_count() * quad_bytes;
+    uint8* source = render_instanced ? (uint8*) render_instances.data() : (uint8*) render_vertices.data();
+
+    GLuint buffer = renderer->vbo;
+    uint32 offset = 0;
+    uint8* memory = NULL;
+    if (total_bytes)
+    {
+        memory = stream_allocate(renderer, total_bytes, &offset);
+        if (memory)
+        {
+            buffer = get_stream_buffer(renderer);
+        }
+        else
+        {
+            fallback.resize(total_bytes);
+            memory = fallback.data();
+            offset = 0;
+        }
+    }
+
+    int cursor = 0;
+    for (Draw_Item& item : render_items)
+    {
+        if (item.mesh) continue;
+
+        memcpy(memory + cursor * quad_bytes, source + item.first_quad * quad_bytes, item.quad_count * quad_bytes);
+        item.first_quad = cursor;
+        cursor += item.quad_count;
+    }
+
+    if (total_bytes)
+    {
+        renderer->stats.bytes_uploaded += total_bytes;
+        if (memory == fallback.data())
+        {
+            bind_array_buffer(renderer, renderer->vbo);
+            glBufferData(GL_ARRAY_BUFFER, total_bytes, memory, GL_STATIC_DRAW);
+        }
+        else
+        {
+            stream_commit(renderer);
+        }
+    }
+
+    int item_count = (int) render_items.size();
+    for (int index = 0; index < item_count; index++)
+    {
+        Draw_Item* item = &render_items[index];
+        if (item->mesh)
+        {
+            Static_Mesh* mesh = item->mesh;
+            draw_quads(renderer, mesh->buffer, 0, mesh->quad_count, mesh->instanced, item->key);
+            continue;
+        }
+
+        int quad_count = item->quad_count;
+        while (index + 1 < item_count)
+        {
+            Draw_Item* next = &render_items[index + 1];
+            if (next->mesh || next->key != item->key) break;
+
+            quad_count += next->quad_count;
+            index++;
+        }
+
+        draw_quads(renderer, buffer, offset + item->first_quad * quad_bytes, quad_count, render_instanced, item->key);
+    }
 
     render_vertices.clear();
-    render_indices.clear();
-}
\ No newline at end of file
+    render_instances.clear();
+    render_items.clear();
+}
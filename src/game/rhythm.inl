@@ -23,9 +23,23 @@ static LK_Wave load_wav_file(const char* path)
 {
     #define ReadNext(Type) *((Type*)(file += sizeof(Type)) - 1)
 
+    struct Info
+    {
+        LK_U16 encoding;
+        LK_U16 channels;
+        LK_U32 frequency;
+        LK_U32 byte_rate;
+        LK_U16 block_align;
+        LK_U16 bits_per_sample;
+    };
+
+    // Everything is declared up front, C++ doesn't allow the gotos below to jump over initializations.
     byte* file;
     LK_U32 chunk_id;
     LK_U32 chunk_size;
+    LK_U32 riff_format;
+    Info info;
+    LK_Wave sound;
     auto seek_to_chunk = [&](LK_U32 search_id)
     {
         while (true)
@@ -45,22 +59,12 @@ static LK_Wave load_wav_file(const char* path)
 
     chunk_id = ReadNext(LK_U32);
     chunk_size = ReadNext(LK_U32);
-    LK_U32 riff_format = ReadNext(LK_U32);
+    riff_format = ReadNext(LK_U32);
     if (chunk_id    != 0x46464952) goto failure; // "RIFF" chunk
     if (riff_format != 0x45564157) goto failure; // "WAVE"
 
-    struct Info
-    {
-        LK_U16 encoding;
-        LK_U16 channels;
-        LK_U32 frequency;
-        LK_U32 byte_rate;
-        LK_U16 block_align;
-        LK_U16 bits_per_sample;
-    };
-
     seek_to_chunk(0x20746D66); // "fmt " chunk
-    Info info = ReadNext(Info);
+    info = ReadNext(Info);
     if (info.encoding != 1) goto failure; // PCM
     if (info.byte_rate != info.frequency * info.channels * (info.bits_per_sample / 8)) goto failure;
     if (info.block_align != info.channels * (info.bits_per_sample / 8)) goto failure;
@@ -69,7 +73,6 @@ static LK_Wave load_wav_file(const char* path)
 
     seek_to_chunk(0x61746164); // "data" chunk
 
-    LK_Wave sound;
     sound.samples = (LK_S16*) malloc(chunk_size);
     sound.count = chunk_size / (2 * info.channels);
     sound.channels = info.channels;
@@ -83,7 +86,6 @@ static LK_Wave load_wav_file(const char* path)
     {
         printf("Failed to load wave file %s!\n", path);
 
-        LK_Wave sound;
         sound.samples = 0;
         sound.count = 0;
         sound.channels = 1;
@@ -334,8 +336,6 @@ void rhythm_render()
     {
         draw_note(&note);
     }
-
-    rendering_flush(&the_game->renderer);
 }
 
 void generate_rhythm()
@@ -361,7 +361,7 @@ void generate_rhythm()
             float duration = 0;
 
             float chance = (i % 2) ? 0.3 : 0.8;
-            float roll = random_float();
+            float roll = random_float(&the_game->random);
             if (roll <= chance)
             {
                 rhythm.notes.push_back({ 0, at, duration, -1, -1 });
@@ -375,7 +375,7 @@ void generate_rhythm()
             float duration = 0;
 
             float chance = (i % 2) ? 0.1 : 0.05;
-            float roll = random_float();
+            float roll = random_float(&the_game->random);
             if (roll <= chance)
             {
                 rhythm.notes.push_back({ 1, at, duration, -1, -1 });
@@ -0,0 +1,521 @@
+// CPU backend for the same draw items the GL backend draws, used when there's no GPU. The game only
+// pushes axis aligned rectangles through orthographic cameras, so a quad is just a pixel rectangle with
+// texture coordinates that step linearly across it. Rasterization rules follow GL: a pixel is covered if
+// its center is inside the rectangle, and the atlas is sampled with nearest filtering. The shadow map is
+// sampled bilinearly like its GL texture.
+//
+// The frame is split into SOFTWARE_TILE_SIZE square tiles. Every quad is binned into the tiles it touches
+// in sorted order, and the tiles are rasterized in parallel, each one walking its own bin front to back.
+// The output only depends on the draw items, not on the tile size or the thread count, which is what makes
+// dumped frames usable as golden images.
+//
+// Pixels are BGRA with the bottom row first, the same as the window canvas and as TGA files.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SOFTWARE_RENDERER_SSE2 1
+#include <emmintrin.h>
+#else
+#define SOFTWARE_RENDERER_SSE2 0
+#endif
+
+const int SOFTWARE_TILE_SIZE = 64;
+
+struct Software_Quad
+{
+    // Covered pixels, clipped to the framebuffer, max exclusive.
+    int x0, y0, x1, y1;
+
+    // Texture coordinate in texels at the center of pixel (x0, y0), and the step per pixel.
+    float s0, ds;
+    float t0, dt;
+
+    uint32 color; // BGRA
+    Blend_Mode blend;
+    Texture_Id texture;
+};
+
+struct Software_Renderer
+{
+    int width;
+    int height;
+    uint32* pixels;
+    std::vector<uint32> own_pixels;
+
+    // The atlas never changes after init_renderer, so it's converted to the framebuffer's byte order once.
+    std::vector<uint32> atlas;
+    int atlas_width;
+    int atlas_height;
+
+    std::vector<Software_Quad> quads;
+    std::vector<std::vector<int>> bins;
+    int tiles_x;
+    int tiles_y;
+};
+
+static uint32 pack_bgra(Vector4 color)
+{
+    uint32 b = (uint32)(clamp_f32(color.b, 0, 1) * 255.0f + 0.5f);
+    uint32 g = (uint32)(clamp_f32(color.g, 0, 1) * 255.0f + 0.5f);
+    uint32 r = (uint32)(clamp_f32(color.r, 0, 1) * 255.0f + 0.5f);
+    uint32 a = (uint32)(clamp_f32(color.a, 0, 1) * 255.0f + 0.5f);
+    return b | (g << 8) | (r << 16) | (a << 24);
+}
+
+// From RGBA bytes, like the atlas and the compact vertex colors.
+static uint32 pack_bgra(uint8* color)
+{
+    return (uint32) color[2] | ((uint32) color[1] << 8) | ((uint32) color[0] << 16) | ((uint32) color[3] << 24);
+}
+
+// Corners and colors of a pushed quad, whatever the vertex layout.
+struct Software_Source
+{
+    float x1, y1, x2, y2;
+    float u1, v1, u2, v2;
+    uint32 color;
+};
+
+#if RENDERER_COMPACT_VERTICES
+
+static Software_Source read_source_quad(uint8* data, bool instanced)
+{
+    Software_Source source;
+    if (instanced)
+    {
+        Sprite_Instance* instance = (Sprite_Instance*) data;
+        source.x1 = instance->position.x;
+        source.y1 = instance->position.y;
+        source.x2 = instance->position.x + instance->size.x;
+        source.y2 = instance->position.y + instance->size.y;
+        source.u1 = instance->uv[0] / 65535.0f;
+        source.v1 = instance->uv[1] / 65535.0f;
+        source.u2 = instance->uv[2] / 65535.0f;
+        source.v2 = instance->uv[3] / 65535.0f;
+        source.color = pack_bgra(instance->color);
+    }
+    else
+    {
+        Vertex* vertices = (Vertex*) data;
+        source.x1 = vertices[0].position.x;
+        source.y1 = vertices[0].position.y;
+        source.x2 = vertices[2].position.x;
+        source.y2 = vertices[2].position.y;
+        source.u1 = vertices[0].uv[0] / 65535.0f;
+        source.v1 = vertices[0].uv[1] / 65535.0f;
+        source.u2 = vertices[2].uv[0] / 65535.0f;
+        source.v2 = vertices[2].uv[1] / 65535.0f;
+        source.color = pack_bgra(vertices[0].color);
+    }
+    return source;
+}
+
+#else
+
+static Software_Source read_source_quad(uint8* data, bool instanced)
+{
+    Software_Source source;
+    if (instanced)
+    {
+        Sprite_Instance* instance = (Sprite_Instance*) data;
+        source.x1 = instance->position.x;
+        source.y1 = instance->position.y;
+        source.x2 = instance->position.x + instance->size.x;
+        source.y2 = instance->position.y + instance->size.y;
+        source.u1 = instance->uv.x;
+        source.v1 = instance->uv.y;
+        source.u2 = instance->uv.z;
+        source.v2 = instance->uv.w;
+        source.color = pack_bgra(instance->color);
+    }
+    else
+    {
+        Vertex* vertices = (Vertex*) data;
+        source.x1 = vertices[0].position.x;
+        source.y1 = vertices[0].position.y;
+        source.x2 = vertices[2].position.x;
+        source.y2 = vertices[2].position.y;
+        source.u1 = vertices[0].uv.x;
+        source.v1 = vertices[0].uv.y;
+        source.u2 = vertices[2].uv.x;
+        source.v2 = vertices[2].uv.y;
+        source.color = pack_bgra(vertices[0].color);
+    }
+    return source;
+}
+
+#endif
+
+void init_software_renderer(Renderer* renderer)
+{
+    Software_Renderer* software = new Software_Renderer();
+    renderer->software = software;
+
+    Atlas* atlas = &renderer->atlas;
+    software->atlas_width = atlas->width;
+    software->atlas_height = atlas->height;
+    int pixel_count = atlas->width * atlas->height;
+    software->atlas.resize(pixel_count);
+    for (int i = 0; i < pixel_count; i++)
+    {
+        uint8* rgba = atlas->data + i * 4;
+        software->atlas[i] = pack_bgra(rgba);
+    }
+}
+
+void software_set_viewport(Renderer* renderer, int width, int height, uint32* pixels)
+{
+    Software_Renderer* software = renderer->software;
+    software->width = width;
+    software->height = height;
+
+    if (pixels)
+    {
+        software->pixels = pixels;
+    }
+    else
+    {
+        software->own_pixels.resize(width * height);
+        software->pixels = software->own_pixels.data();
+    }
+
+    software->tiles_x = (width  + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE;
+    software->tiles_y = (height + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE;
+    software->bins.resize(software->tiles_x * software->tiles_y);
+}
+
+void software_clear(Renderer* renderer, Vector4 color)
+{
+    Software_Renderer* software = renderer->software;
+    std::fill(software->pixels, software->pixels + software->width * software->height, pack_bgra(color));
+}
+
+// a * b / 255, rounded, for a and b in [0, 255].
+static inline uint32 mul_unorm8(uint32 a, uint32 b)
+{
+    uint32 t = a * b + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+static uint32 shade_pixel(uint32 texel, uint32 destination, uint32 color, Blend_Mode blend)
+{
+    uint32 source_alpha = mul_unorm8(texel >> 24, color >> 24);
+
+    uint32 result = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        uint32 source = mul_unorm8((texel >> shift) & 0xFF, (color >> shift) & 0xFF);
+        uint32 target = (destination >> shift) & 0xFF;
+        if (blend == BLEND_ALPHA)    source = mul_unorm8(source, source_alpha) + mul_unorm8(target, 255 - source_alpha);
+        if (blend == BLEND_MULTIPLY) source = mul_unorm8(source, target);
+        result |= source << shift;
+    }
+
+    return result;
+}
+
+#if SOFTWARE_RENDERER_SSE2
+
+// Same math as mul_unorm8 and shade_pixel, on two pixels widened to 16 bits per channel.
+static inline __m128i mul_unorm8_sse2(__m128i a, __m128i b)
+{
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(a, b), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+static inline __m128i shade_pixels_sse2(__m128i texels, __m128i destination, __m128i color, Blend_Mode blend)
+{
+    __m128i source = mul_unorm8_sse2(texels, color);
+    if (blend == BLEND_ALPHA)
+    {
+        __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(source, 0xFF), 0xFF);
+        __m128i inverse = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+        return _mm_add_epi16(mul_unorm8_sse2(source, alpha), mul_unorm8_sse2(destination, inverse));
+    }
+    if (blend == BLEND_MULTIPLY)
+    {
+        return mul_unorm8_sse2(source, destination);
+    }
+    return source;
+}
+
+#endif
+
+// Tints count texels by color and blends them into destination.
+static void shade_span(uint32* destination, uint32* texels, int count, uint32 color, Blend_Mode blend)
+{
+    int i = 0;
+
+#if SOFTWARE_RENDERER_SSE2
+    __m128i zero = _mm_setzero_si128();
+    __m128i wide_color = _mm_unpacklo_epi8(_mm_set1_epi32(color), zero);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i source = _mm_loadu_si128((__m128i*)(texels + i));
+        __m128i target = _mm_loadu_si128((__m128i*)(destination + i));
+        __m128i low  = shade_pixels_sse2(_mm_unpacklo_epi8(source, zero), _mm_unpacklo_epi8(target, zero), wide_color, blend);
+        __m128i high = shade_pixels_sse2(_mm_unpackhi_epi8(source, zero), _mm_unpackhi_epi8(target, zero), wide_color, blend);
+        _mm_storeu_si128((__m128i*)(destination + i), _mm_packus_epi16(low, high));
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        destination[i] = shade_pixel(texels[i], destination[i], color, blend);
+    }
+}
+
+static void rasterize_atlas_quad(Software_Renderer* software, Software_Quad* quad, int x0, int y0, int x1, int y1)
+{
+    int texel_x[SOFTWARE_TILE_SIZE];
+    uint32 texels[SOFTWARE_TILE_SIZE];
+    int count = x1 - x0;
+
+    // Coordinates are computed from the quad's first pixel every time instead of accumulated, so a pixel
+    // samples the same texel no matter which tile it ended up in.
+    for (int x = x0; x < x1; x++)
+    {
+        int s = (int) floorf(quad->s0 + (x - quad->x0) * quad->ds);
+        texel_x[x - x0] = clamp_i32(s, 0, software->atlas_width - 1);
+    }
+
+    for (int y = y0; y < y1; y++)
+    {
+        int t = (int) floorf(quad->t0 + (y - quad->y0) * quad->dt);
+        uint32* row = software->atlas.data() + clamp_i32(t, 0, software->atlas_height - 1) * software->atlas_width;
+        for (int i = 0; i < count; i++)
+        {
+            texels[i] = row[texel_x[i]];
+        }
+
+        shade_span(software->pixels + y * software->width + x0, texels, count, quad->color, quad->blend);
+    }
+}
+
+// The shadow map texture is black with the texel value as alpha, filtered bilinearly.
+static void rasterize_shadow_quad(Software_Renderer* software, Shadow_Map* map, Software_Quad* quad, int x0, int y0, int x1, int y1)
+{
+    int texel_x[SOFTWARE_TILE_SIZE];
+    int weight_x[SOFTWARE_TILE_SIZE];
+    uint32 texels[SOFTWARE_TILE_SIZE];
+    int count = x1 - x0;
+
+    for (int x = x0; x < x1; x++)
+    {
+        float s = quad->s0 + (x - quad->x0) * quad->ds - 0.5f;
+        float s_floor = floorf(s);
+        texel_x[x - x0] = (int) s_floor;
+        weight_x[x - x0] = (int)((s - s_floor) * 256.0f);
+    }
+
+    for (int y = y0; y < y1; y++)
+    {
+        float t = quad->t0 + (y - quad->y0) * quad->dt - 0.5f;
+        float t_floor = floorf(t);
+        int weight_y = (int)((t - t_floor) * 256.0f);
+
+        uint8* row0 = map->pixels + clamp_i32((int) t_floor,     0, map->height - 1) * map->width;
+        uint8* row1 = map->pixels + clamp_i32((int) t_floor + 1, 0, map->height - 1) * map->width;
+
+        for (int i = 0; i < count; i++)
+        {
+            int s0 = clamp_i32(texel_x[i],     0, map->width - 1);
+            int s1 = clamp_i32(texel_x[i] + 1, 0, map->width - 1);
+            uint32 bottom = row0[s0] * (256 - weight_x[i]) + row0[s1] * weight_x[i];
+            uint32 top    = row1[s0] * (256 - weight_x[i]) + row1[s1] * weight_x[i];
+            uint32 alpha  = (bottom * (256 - weight_y) + top * weight_y + 32768) >> 16;
+            texels[i] = alpha << 24;
+        }
+
+        shade_span(software->pixels + y * software->width + x0, texels, count, quad->color, quad->blend);
+    }
+}
+
+static void rasterize_tile(void* data, int tile)
+{
+    Renderer* renderer = (Renderer*) data;
+    Software_Renderer* software = renderer->software;
+
+    int min_x = (tile % software->tiles_x) * SOFTWARE_TILE_SIZE;
+    int min_y = (tile / software->tiles_x) * SOFTWARE_TILE_SIZE;
+    int max_x = min_i32(min_x + SOFTWARE_TILE_SIZE, software->width);
+    int max_y = min_i32(min_y + SOFTWARE_TILE_SIZE, software->height);
+
+    for (int index : software->bins[tile])
+    {
+        Software_Quad* quad = &software->quads[index];
+        int x0 = max_i32(quad->x0, min_x);
+        int y0 = max_i32(quad->y0, min_y);
+        int x1 = min_i32(quad->x1, max_x);
+        int y1 = min_i32(quad->y1, max_y);
+
+        if (quad->texture == TEXTURE_SHADOW_MAP)
+        {
+            if (!renderer->shadow_map.pixels) continue;
+            rasterize_shadow_quad(software, &renderer->shadow_map, quad, x0, y0, x1, y1);
+        }
+        else
+        {
+            rasterize_atlas_quad(software, quad, x0, y0, x1, y1);
+        }
+    }
+}
+
+// Pixel coordinate of the left or bottom edge of the first pixel whose center is at or past edge.
+static int get_first_covered_pixel(float edge)
+{
+    return (int) ceilf(edge - 0.5f);
+}
+
+static void add_software_quad(Software_Renderer* software, Software_Source* source, Matrix4* camera,
+                              int texture_width, int texture_height, uint32 key)
+{
+    // Orthographic cameras only, so the w coordinate is ignored.
+    float sx1 = (camera->m[0][0] * source->x1 + camera->m[1][0] * source->y1 + camera->m[3][0] + 1) * 0.5f * software->width;
+    float sx2 = (camera->m[0][0] * source->x2 + camera->m[1][0] * source->y2 + camera->m[3][0] + 1) * 0.5f * software->width;
+    float sy1 = (camera->m[0][1] * source->x1 + camera->m[1][1] * source->y1 + camera->m[3][1] + 1) * 0.5f * software->height;
+    float sy2 = (camera->m[0][1] * source->x2 + camera->m[1][1] * source->y2 + camera->m[3][1] + 1) * 0.5f * software->height;
+    if (sx1 == sx2 || sy1 == sy2) return;
+
+    Software_Quad quad;
+    quad.x0 = max_i32(get_first_covered_pixel(min_f32(sx1, sx2)), 0);
+    quad.y0 = max_i32(get_first_covered_pixel(min_f32(sy1, sy2)), 0);
+    quad.x1 = min_i32(get_first_covered_pixel(max_f32(sx1, sx2)), software->width);
+    quad.y1 = min_i32(get_first_covered_pixel(max_f32(sy1, sy2)), software->height);
+    if (quad.x0 >= quad.x1 || quad.y0 >= quad.y1) return;
+
+    quad.ds = (source->u2 - source->u1) * texture_width  / (sx2 - sx1);
+    quad.dt = (source->v2 - source->v1) * texture_height / (sy2 - sy1);
+    quad.s0 = source->u1 * texture_width  + (quad.x0 + 0.5f - sx1) * quad.ds;
+    quad.t0 = source->v1 * texture_height + (quad.y0 + 0.5f - sy1) * quad.dt;
+
+    quad.color = source->color;
+    quad.blend = get_key_blend(key);
+    quad.texture = get_key_texture(key);
+    software->quads.push_back(quad);
+}
+
+// Rasterizes the sorted draw items into the current viewport.
+void software_render_frame(Renderer* renderer)
+{
+    Software_Renderer* software = renderer->software;
+    if (!software->pixels) return;
+
+    software->quads.clear();
+    for (Draw_Item& item : render_items)
+    {
+        Static_Mesh* mesh = item.mesh;
+        bool instanced = mesh ? mesh->instanced : render_instanced;
+        uint32 quad_bytes = get_quad_bytes(instanced);
+
+        uint8* data;
+        if (mesh) data = mesh->data;
+        else if (instanced) data = (uint8*) render_instances.data() + item.first_quad * quad_bytes;
+        else data = (uint8*) render_vertices.data() + item.first_quad * quad_bytes;
+
+        int texture_width = software->atlas_width;
+        int texture_height = software->atlas_height;
+        if (get_key_texture(item.key) == TEXTURE_SHADOW_MAP)
+        {
+            texture_width = renderer->shadow_map.width;
+            texture_height = renderer->shadow_map.height;
+        }
+
+        Matrix4* camera = &render_cameras[get_key_camera(item.key)];
+        for (int i = 0; i < item.quad_count; i++)
+        {
+            Software_Source source = read_source_quad(data + i * quad_bytes, instanced);
+            add_software_quad(software, &source, camera, texture_width, texture_height, item.key);
+        }
+    }
+
+    for (std::vector<int>& bin : software->bins)
+    {
+        bin.clear();
+    }
+
+    int quad_count = (int) software->quads.size();
+    for (int index = 0; index < quad_count; index++)
+    {
+        Software_Quad* quad = &software->quads[index];
+        int tile_x0 = quad->x0 / SOFTWARE_TILE_SIZE;
+        int tile_y0 = quad->y0 / SOFTWARE_TILE_SIZE;
+        int tile_x1 = (quad->x1 - 1) / SOFTWARE_TILE_SIZE;
+        int tile_y1 = (quad->y1 - 1) / SOFTWARE_TILE_SIZE;
+        for (int tile_y = tile_y0; tile_y <= tile_y1; tile_y++)
+        {
+            for (int tile_x = tile_x0; tile_x <= tile_x1; tile_x++)
+            {
+                software->bins[tile_y * software->tiles_x + tile_x].push_back(index);
+            }
+        }
+    }
+
+    parallel_for(software->bins.size(), rasterize_tile, renderer);
+}
+
+// Writes the last rendered frame as an uncompressed 32-bit TGA, whose native layout is the framebuffer's.
+bool save_frame_tga(Renderer* renderer, const char* path)
+{
+    Software_Renderer* software = renderer->software;
+    if (!software || !software->pixels) return false;
+
+    FILE* file = fopen(path, "wb");
+    if (!file)
+    {
+        printf("Failed to open %s for writing\n", path);
+        return false;
+    }
+
+    uint8 header[18] = {};
+    header[2] = 2;
+    header[12] = software->width & 0xFF;
+    header[13] = software->width >> 8;
+    header[14] = software->height & 0xFF;
+    header[15] = software->height >> 8;
+    header[16] = 32;
+    header[17] = 8;
+
+    fwrite(header, sizeof(header), 1, file);
+    fwrite(software->pixels, sizeof(uint32), software->width * software->height, file);
+    fclose(file);
+    return true;
+}
+
+// Compares the last rendered frame with one written by save_frame_tga. Returns the number of pixels that
+// differ, or -1 if the file can't be read or isn't a frame of the same size.
+int compare_frame_tga(Renderer* renderer, const char* path)
+{
+    Software_Renderer* software = renderer->software;
+    if (!software || !software->pixels) return -1;
+
+    FILE* file = fopen(path, "rb");
+    if (!file)
+    {
+        printf("Failed to open file %s\n", path);
+        return -1;
+    }
+
+    int pixel_count = software->width * software->height;
+    std::vector<uint32> pixels(pixel_count);
+
+    uint8 header[18];
+    bool valid = fread(header, sizeof(header), 1, file) == 1 &&
+                 header[0] == 0 && header[2] == 2 && header[16] == 32 &&
+                 (header[12] | header[13] << 8) == software->width &&
+                 (header[14] | header[15] << 8) == software->height &&
+                 fread(pixels.data(), sizeof(uint32), pixel_count, file) == (size_t) pixel_count;
+    fclose(file);
+
+    if (!valid)
+    {
+        printf("%s is not a %dx%d frame\n", path, software->width, software->height);
+        return -1;
+    }
+
+    int different = 0;
+    for (int i = 0; i < pixel_count; i++)
+    {
+        different += pixels[i] != software->pixels[i];
+    }
+    return different;
+}
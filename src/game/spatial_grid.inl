@@ -0,0 +1,108 @@
+// A uniform grid over the level for finding entities near a point or box without scanning all of them.
+// Entities are bucketed by the cell their center falls in, and queries grow their box by the largest half
+// size that was added, so every entity is in exactly one cell and no result shows up twice.
+//
+// The grid is a snapshot taken when it's built. Queries are padded by SPATIAL_GRID_MARGIN tiles so that
+// entities which moved less than that since the build are still found. Results are candidates only, the
+// caller does the exact test against current positions.
+const int SPATIAL_GRID_CELL_SIZE = 4;
+const float SPATIAL_GRID_MARGIN = 1;
+
+struct Spatial_Grid
+{
+    int width;
+    int height;
+    float max_extent;
+
+    // The ids in cell i are items[cell_start[i]] up to items[cell_start[i + 1]].
+    std::vector<int> cell_start;
+    std::vector<int> items;
+
+    std::vector<int> added_ids;
+    std::vector<int> added_cells;
+};
+
+static int get_spatial_grid_cell_x(Spatial_Grid* grid, float x)
+{
+    return clamp_i32((int) floorf(x / SPATIAL_GRID_CELL_SIZE), 0, grid->width - 1);
+}
+
+static int get_spatial_grid_cell_y(Spatial_Grid* grid, float y)
+{
+    return clamp_i32((int) floorf(y / SPATIAL_GRID_CELL_SIZE), 0, grid->height - 1);
+}
+
+// The grid covers tiles_x by tiles_y tiles, anything outside goes into the nearest edge cell.
+void clear_spatial_grid(Spatial_Grid* grid, int tiles_x, int tiles_y)
+{
+    grid->width  = max_i32((tiles_x + SPATIAL_GRID_CELL_SIZE - 1) / SPATIAL_GRID_CELL_SIZE, 1);
+    grid->height = max_i32((tiles_y + SPATIAL_GRID_CELL_SIZE - 1) / SPATIAL_GRID_CELL_SIZE, 1);
+    grid->max_extent = 0;
+    grid->added_ids.clear();
+    grid->added_cells.clear();
+}
+
+void add_to_spatial_grid(Spatial_Grid* grid, int id, Vector2 center, Vector2 size)
+{
+    int cell_x = get_spatial_grid_cell_x(grid, center.x);
+    int cell_y = get_spatial_grid_cell_y(grid, center.y);
+    grid->added_ids.push_back(id);
+    grid->added_cells.push_back(cell_y * grid->width + cell_x);
+    grid->max_extent = max_f32(grid->max_extent, max_f32(size.x, size.y) * 0.5f);
+}
+
+// Sorts everything added since clear_spatial_grid into its cell, a counting sort so it's linear.
+void build_spatial_grid(Spatial_Grid* grid)
+{
+    int cell_count = grid->width * grid->height;
+    grid->cell_start.assign(cell_count + 1, 0);
+    grid->items.resize(grid->added_ids.size());
+
+    for (int cell : grid->added_cells)
+    {
+        grid->cell_start[cell + 1]++;
+    }
+    for (int i = 0; i < cell_count; i++)
+    {
+        grid->cell_start[i + 1] += grid->cell_start[i];
+    }
+
+    // Filling moves each cell_start to the start of the next cell, shifting them back up undoes that.
+    for (int i = 0; i < (int) grid->added_ids.size(); i++)
+    {
+        int cell = grid->added_cells[i];
+        grid->items[grid->cell_start[cell]++] = grid->added_ids[i];
+    }
+    for (int i = cell_count; i > 0; i--)
+    {
+        grid->cell_start[i] = grid->cell_start[i - 1];
+    }
+    grid->cell_start[0] = 0;
+}
+
+// Replaces the contents of results with the ids of everything that may overlap the box, in cell order.
+void query_aabb(Spatial_Grid* grid, Vector2 center, Vector2 size, std::vector<int>* results)
+{
+    results->clear();
+    if (grid->cell_start.empty()) return;
+
+    float extent_x = size.x * 0.5f + grid->max_extent + SPATIAL_GRID_MARGIN;
+    float extent_y = size.y * 0.5f + grid->max_extent + SPATIAL_GRID_MARGIN;
+    int min_x = get_spatial_grid_cell_x(grid, center.x - extent_x);
+    int min_y = get_spatial_grid_cell_y(grid, center.y - extent_y);
+    int max_x = get_spatial_grid_cell_x(grid, center.x + extent_x);
+    int max_y = get_spatial_grid_cell_y(grid, center.y + extent_y);
+
+    for (int y = min_y; y <= max_y; y++)
+    {
+        int first = grid->cell_start[y * grid->width + min_x];
+        int last  = grid->cell_start[y * grid->width + max_x + 1];
+        results->insert(results->end(), grid->items.begin() + first, grid->items.begin() + last);
+    }
+}
+
+// Replaces the contents of results with the ids of everything that may be within radius of center.
+void query_radius(Spatial_Grid* grid, Vector2 center, float radius, std::vector<int>* results)
+{
+    query_aabb(grid, center, vector2(radius * 2, radius * 2), results);
+}
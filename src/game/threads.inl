@@ -0,0 +1,141 @@
+// A fixed set of worker threads for splitting loops across cores. parallel_for hands out indices one at
+// a time, and the calling thread works along with the pool until every index is done, so it returns only
+// after all calls have finished. Workers are started on first use and run until stop_thread_pool, which
+// has to be called before the game library is unloaded, because they run its code. The next parallel_for
+// starts a new pool.
+//
+// Only the main thread may call parallel_for. A nested call from inside a parallel function runs serially.
+typedef void Parallel_Function(void* data, int index);
+
+const int MAX_WORKER_THREADS = 15;
+
+struct Thread_Pool
+{
+    int thread_count;
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    uint64 generation;
+    int working;
+    bool quit;
+
+    Parallel_Function* function;
+    void* data;
+    int count;
+    std::atomic<int> next;
+};
+
+static Thread_Pool* thread_pool;
+static thread_local bool inside_parallel_for;
+
+static void run_parallel_indices(Thread_Pool* pool)
+{
+    inside_parallel_for = true;
+    while (true)
+    {
+        int index = pool->next++;
+        if (index >= pool->count) break;
+        pool->function(pool->data, index);
+    }
+    inside_parallel_for = false;
+}
+
+static void worker_thread_main(Thread_Pool* pool)
+{
+    uint64 seen_generation = 0;
+
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    while (true)
+    {
+        pool->wake.wait(lock, [&] { return pool->generation != seen_generation || pool->quit; });
+        if (pool->quit) return;
+        seen_generation = pool->generation;
+
+        lock.unlock();
+        run_parallel_indices(pool);
+        lock.lock();
+
+        if (--pool->working == 0)
+        {
+            pool->finished.notify_one();
+        }
+    }
+}
+
+static Thread_Pool* get_thread_pool()
+{
+    if (!thread_pool)
+    {
+        Thread_Pool* pool = new Thread_Pool();
+        thread_pool = pool;
+
+        int cores = std::thread::hardware_concurrency();
+        int count = clamp_i32(cores - 1, 0, MAX_WORKER_THREADS);
+        for (int i = 0; i < count; i++)
+        {
+            pool->threads.emplace_back(worker_thread_main, pool);
+        }
+        pool->thread_count = count;
+    }
+
+    return thread_pool;
+}
+
+// Waits for the workers to exit and frees the pool. Only called between parallel_for calls, so no worker
+// is in the middle of a job.
+void stop_thread_pool()
+{
+    Thread_Pool* pool = thread_pool;
+    if (!pool) return;
+
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->quit = true;
+    }
+    pool->wake.notify_all();
+
+    for (std::thread& thread : pool->threads)
+    {
+        thread.join();
+    }
+
+    delete pool;
+    thread_pool = NULL;
+}
+
+int get_worker_count()
+{
+    return get_thread_pool()->thread_count;
+}
+
+void parallel_for(int count, Parallel_Function* function, void* data)
+{
+    Thread_Pool* pool = get_thread_pool();
+    if (count <= 1 || inside_parallel_for || !pool->thread_count)
+    {
+        for (int index = 0; index < count; index++)
+        {
+            function(data, index);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->function = function;
+        pool->data = data;
+        pool->count = count;
+        pool->next = 0;
+        pool->working = pool->thread_count;
+        pool->generation++;
+    }
+    pool->wake.notify_all();
+
+    run_parallel_indices(pool);
+
+    // Workers that woke up late still have to pass through the counter before the next job can start.
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    pool->finished.wait(lock, [&] { return pool->working == 0; });
+}
@@ -0,0 +1,648 @@
+// The streaming world is an endless cave made of CHUNK_SIZE chunks that are generated when the camera gets
+// near them. The level is a window of WORLD_WINDOW_CHUNKS x WORLD_WINDOW_CHUNKS chunks into it, and all
+// level coordinates are relative to the window's corner. When the camera wanders away from the middle of
+// the window, the window moves in whole chunks and everything in the level shifts back by the same
+// amount, so positions stay small however far the player goes.
+//
+// Chunks are generated on background threads and picked up at the start of a frame, a frame never waits
+// for one. Chunks in the window that aren't ready yet are solid. Generated chunks are cached and the least
+// recently used ones are thrown away once there are more than WORLD_CHUNK_BUDGET of them, they come out
+// the same when generated again.
+//
+// A chunk's cells only depend on the noise within WORLD_CHUNK_HALO cells of it, so each chunk runs the
+// automaton on itself plus that border and the chunks line up exactly.
+const int WORLD_WINDOW_CHUNKS = 8;
+const int WORLD_PREFETCH_CHUNKS = 2;
+const int WORLD_CHUNK_BUDGET = 512;
+const int WORLD_CHUNK_HALO = CAVE_ITERATION_COUNT + 1;
+
+enum World_Spawned
+{
+    SPAWNED_TREASURE = 1,
+    SPAWNED_MONSTERS = 2,
+};
+
+struct World_Generator
+{
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<World_Chunk*> requests;
+    std::vector<World_Chunk*> finished;
+    bool quit;
+};
+
+// Started on first use. Like the thread pool, it has to be stopped with stop_world_generator before the game
+// library is unloaded.
+static World_Generator* world_generator;
+
+static uint64 get_world_chunk_key(int chunk_x, int chunk_y)
+{
+    return ((uint64)(uint32) chunk_x << 32) | (uint32) chunk_y;
+}
+
+static uint64 get_world_seed(uint64 seed, Generator_Stream stream)
+{
+    Random random = generator_random(seed, stream, 0);
+    return next_random64(&random);
+}
+
+void generate_world_chunk(World_Chunk* chunk)
+{
+    const int SIZE = CHUNK_SIZE + 2 * WORLD_CHUNK_HALO;
+    int base_x = chunk->chunk_x * CHUNK_SIZE - WORLD_CHUNK_HALO;
+    int base_y = chunk->chunk_y * CHUNK_SIZE - WORLD_CHUNK_HALO;
+
+    Bit_Grid read = {};
+    Bit_Grid write = {};
+    resize_bit_grid(&read,  SIZE, SIZE);
+    resize_bit_grid(&write, SIZE, SIZE);
+
+    uint64 tile_seed = get_world_seed(chunk->seed, GENERATOR_STREAM_SEED);
+    for (int y = 0; y < SIZE; y++)
+    {
+        for (int x = 0; x < SIZE; x++)
+        {
+            set_bit(&write, x, y, random_float_at(tile_seed, base_x + x, base_y + y) < CAVE_INITIAL_CHANCE);
+        }
+    }
+
+    for (int step = 0; step < CAVE_ITERATION_COUNT; step++)
+    {
+        std::swap(read, write);
+        generator_step(&read, &write, 0, SIZE, CAVE_BIRTH_LIMIT, CAVE_DEATH_LIMIT);
+    }
+
+    for (int y = 0; y < CHUNK_SIZE; y++)
+    {
+        for (int x = 0; x < CHUNK_SIZE; x++)
+        {
+            chunk->tiles[y * CHUNK_SIZE + x] = get_bit(&write, x + WORLD_CHUNK_HALO, y + WORLD_CHUNK_HALO);
+        }
+    }
+
+    // The halo is one cell wider than the automaton needs, so the neighbor counts here are exact too.
+    uint64 treasure_seed = get_world_seed(chunk->seed, GENERATOR_STREAM_TREASURE);
+    chunk->treasure.clear();
+    for (int y = 0; y < CHUNK_SIZE; y++)
+    {
+        for (int x = 0; x < CHUNK_SIZE; x++)
+        {
+            int grid_x = x + WORLD_CHUNK_HALO;
+            int grid_y = y + WORLD_CHUNK_HALO;
+            if (get_bit(&write, grid_x, grid_y)) continue;
+
+            int count = 0;
+            for (int dy = -1; dy <= 1; dy++)
+            {
+                for (int dx = -1; dx <= 1; dx++)
+                {
+                    count += get_bit(&write, grid_x + dx, grid_y + dy);
+                }
+            }
+
+            if (count >= CAVE_TREASURE_LIMIT &&
+                random_float_at(treasure_seed, base_x + grid_x, base_y + grid_y) <= CAVE_TREASURE_CHANCE)
+            {
+                chunk->treasure.push_back(vector2(x + 0.5, y + 0.5));
+            }
+        }
+    }
+
+    // Monsters go on the chunk's spawn cells, out of the regions of the grid that reach its edge. A region
+    // closed off inside the grid is a pocket nothing can get into. Whether a monster can actually reach
+    // the player is only known once the chunk is in the window, see spawn_world_monsters.
+    Spawn_Regions regions = {};
+    find_spawn_regions(&write, &regions);
+
+    std::vector<uint8> reaches_edge(regions.region_count, false);
+    for (int cell : regions.cells)
+    {
+        int x = cell % SIZE;
+        int y = cell / SIZE;
+        if (x == 0 || y == 0 || x == SIZE - 2 || y == SIZE - 2)
+        {
+            reaches_edge[regions.labels[cell]] = true;
+        }
+    }
+
+    std::vector<int> cells;
+    for (int y = WORLD_CHUNK_HALO; y < WORLD_CHUNK_HALO + CHUNK_SIZE; y++)
+    {
+        for (int x = WORLD_CHUNK_HALO; x < WORLD_CHUNK_HALO + CHUNK_SIZE; x++)
+        {
+            int region = regions.labels[y * SIZE + x];
+            if (region >= 0 && reaches_edge[region])
+            {
+                cells.push_back(y * SIZE + x);
+            }
+        }
+    }
+
+    // The same density as generate_level_cave, with the remainder rounded randomly.
+    uint64 monster_seed = get_world_seed(chunk->seed, GENERATOR_STREAM_MONSTERS);
+    Random random = seed_random(monster_seed, get_world_chunk_key(chunk->chunk_x, chunk->chunk_y));
+    int monster_count = (int) cells.size() / CAVE_CELLS_PER_MONSTER;
+    if (random_int(&random, CAVE_CELLS_PER_MONSTER) < (int) cells.size() % CAVE_CELLS_PER_MONSTER)
+    {
+        monster_count++;
+    }
+
+    chunk->monsters.clear();
+    for (int i = 0; i < monster_count; i++)
+    {
+        int cell = cells[random_int(&random, (int) cells.size())];
+        chunk->monsters.push_back(vector2(cell % SIZE - WORLD_CHUNK_HALO + 1, cell / SIZE - WORLD_CHUNK_HALO + 1));
+    }
+}
+
+static void world_generator_thread_main(World_Generator* generator)
+{
+    std::unique_lock<std::mutex> lock(generator->mutex);
+    while (true)
+    {
+        generator->wake.wait(lock, [&] { return !generator->requests.empty() || generator->quit; });
+        if (generator->quit) return;
+
+        World_Chunk* chunk = generator->requests.front();
+        generator->requests.pop_front();
+
+        lock.unlock();
+        generate_world_chunk(chunk);
+        lock.lock();
+
+        generator->finished.push_back(chunk);
+    }
+}
+
+static World_Generator* get_world_generator()
+{
+    if (!world_generator)
+    {
+        World_Generator* generator = new World_Generator();
+        world_generator = generator;
+
+        // Chunks that weren't ready when the last generator was stopped, see stop_world_generator.
+        for (auto& entry : the_game->world.chunks)
+        {
+            if (!entry.second->ready)
+            {
+                generator->requests.push_back(entry.second);
+            }
+        }
+
+        // The worker pool is busy with parallel_for when the main thread is, these run at the same time.
+        int count = max_i32(get_worker_count(), 1);
+        for (int i = 0; i < count; i++)
+        {
+            generator->threads.emplace_back(world_generator_thread_main, generator);
+        }
+    }
+
+    return world_generator;
+}
+
+// Waits for the generator threads to exit and frees the generator, chunks being generated are finished
+// first. Chunks of the current world that are still queued or haven't been picked up stay in world.chunks
+// without being ready, the next generator requests them again. The rest belong to an old world.
+void stop_world_generator()
+{
+    World_Generator* generator = world_generator;
+    if (!generator) return;
+
+    {
+        std::lock_guard<std::mutex> lock(generator->mutex);
+        generator->quit = true;
+    }
+    generator->wake.notify_all();
+
+    for (std::thread& thread : generator->threads)
+    {
+        thread.join();
+    }
+
+    auto& world = the_game->world;
+    for (World_Chunk* chunk : generator->requests)
+    {
+        if (chunk->world_id != world.id)
+        {
+            delete chunk;
+        }
+    }
+    for (World_Chunk* chunk : generator->finished)
+    {
+        if (chunk->world_id != world.id)
+        {
+            delete chunk;
+        }
+    }
+
+    delete generator;
+    world_generator = NULL;
+}
+
+static World_Chunk* find_world_chunk(int chunk_x, int chunk_y)
+{
+    auto& world = the_game->world;
+    auto it = world.chunks.find(get_world_chunk_key(chunk_x, chunk_y));
+    return (it == world.chunks.end()) ? NULL : it->second;
+}
+
+static World_Chunk* new_world_chunk(int chunk_x, int chunk_y)
+{
+    auto& world = the_game->world;
+
+    World_Chunk* chunk = new World_Chunk();
+    chunk->chunk_x = chunk_x;
+    chunk->chunk_y = chunk_y;
+    chunk->world_id = world.id;
+    chunk->seed = world.seed;
+    chunk->last_used = world.frame;
+    world.chunks[get_world_chunk_key(chunk_x, chunk_y)] = chunk;
+    return chunk;
+}
+
+// Copies a window chunk into level.tiles, or fills it with solid tiles if it isn't generated yet. The
+// first time a chunk's tiles go in, its treasure is added too, monsters wait for spawn_world_monsters.
+static void fill_window_chunk(int window_x, int window_y)
+{
+    auto& world = the_game->world;
+    auto& level = the_game->level;
+
+    World_Chunk* chunk = find_world_chunk(world.origin_x + window_x, world.origin_y + window_y);
+    bool ready = chunk && chunk->ready;
+
+    int tile_x = window_x * CHUNK_SIZE;
+    int tile_y = window_y * CHUNK_SIZE;
+    for (int y = 0; y < CHUNK_SIZE; y++)
+    {
+        Tile* row = level.tiles + (tile_y + y) * level.width + tile_x;
+        for (int x = 0; x < CHUNK_SIZE; x++)
+        {
+            row[x].z = ready ? chunk->tiles[y * CHUNK_SIZE + x] : 1;
+        }
+    }
+
+    uint8& spawned = world.spawned[window_y * WORLD_WINDOW_CHUNKS + window_x];
+    if (!ready || (spawned & SPAWNED_TREASURE)) return;
+    spawned |= SPAWNED_TREASURE;
+
+    Vector2 corner = vector2(tile_x, tile_y);
+    for (Vector2 position : chunk->treasure)
+    {
+        Entity treasure = {};
+        treasure.brain = BRAIN_TREASURE;
+        treasure.position = corner + position;
+        treasure.size = vector2(1, 1);
+        treasure.texture = the_game->art.barrel;
+        add_entity(&level.entities, treasure);
+    }
+}
+
+// Adds the monsters of window chunks that are in but haven't had theirs yet, only the ones whose spawn
+// cell is in the player's region of the window. Tiles of chunks that aren't in yet are solid and the world
+// past the window isn't looked at, so that region can only be smaller than the one in the whole world and
+// every monster added can reach the player. Monsters that can't are dropped with the rest of the chunk's.
+static void spawn_world_monsters()
+{
+    auto& world = the_game->world;
+    auto& level = the_game->level;
+
+    int player = find_player(&level.entities);
+    if (player < 0) return;
+
+    std::vector<int> pending;
+    for (int i = 0; i < WORLD_WINDOW_CHUNKS * WORLD_WINDOW_CHUNKS; i++)
+    {
+        if ((world.spawned[i] & SPAWNED_TREASURE) && !(world.spawned[i] & SPAWNED_MONSTERS))
+        {
+            pending.push_back(i);
+        }
+    }
+    if (pending.empty()) return;
+
+    Spawn_Regions regions = {};
+    find_spawn_regions(&level.solid, &regions);
+
+    // The player's region is the one of any spawn cell whose 2x2 block has the player's position in it.
+    Vector2 player_position = level.entities.position[player];
+    int player_x = (int) floorf(player_position.x);
+    int player_y = (int) floorf(player_position.y);
+    int player_region = -1;
+    for (int y = player_y - 1; y <= player_y && player_region < 0; y++)
+    {
+        for (int x = player_x - 1; x <= player_x && player_region < 0; x++)
+        {
+            if (x < 0 || x >= level.width || y < 0 || y >= level.height) continue;
+            player_region = regions.labels[y * level.width + x];
+        }
+    }
+
+    // Wait for the player to get back into the open.
+    if (player_region < 0) return;
+
+    for (int i : pending)
+    {
+        world.spawned[i] |= SPAWNED_MONSTERS;
+
+        int window_x = i % WORLD_WINDOW_CHUNKS;
+        int window_y = i / WORLD_WINDOW_CHUNKS;
+        World_Chunk* chunk = find_world_chunk(world.origin_x + window_x, world.origin_y + window_y);
+        Vector2 corner = vector2(window_x * CHUNK_SIZE, window_y * CHUNK_SIZE);
+
+        for (Vector2 position : chunk->monsters)
+        {
+            Vector2 center = corner + position;
+            int cell = ((int) center.y - 1) * level.width + ((int) center.x - 1);
+            if (regions.labels[cell] != player_region) continue;
+
+            Entity monster = {};
+            monster.brain = BRAIN_MONSTER;
+            monster.size = vector2(1.2, 1.2);
+            monster.position = center - 0.5 * monster.size;
+            monster.texture = the_game->art.white;
+            monster.health = 5;
+            monster.max_health = 5;
+            add_entity(&level.entities, monster);
+        }
+    }
+}
+
+static void free_world_chunks()
+{
+    auto& world = the_game->world;
+
+    // Chunks still being generated are freed when they come back with an old world id.
+    for (auto& entry : world.chunks)
+    {
+        if (entry.second->ready)
+        {
+            delete entry.second;
+        }
+    }
+    world.chunks.clear();
+}
+
+static void generate_world_chunk_job(void* data, int index)
+{
+    World_Chunk** chunks = (World_Chunk**) data;
+    generate_world_chunk(chunks[index]);
+}
+
+void start_world(uint64 seed)
+{
+    auto& world = the_game->world;
+    auto& level = the_game->level;
+
+    free_world_chunks();
+    world.id++;
+    world.seed = seed;
+    world.origin_x = -WORLD_WINDOW_CHUNKS / 2;
+    world.origin_y = -WORLD_WINDOW_CHUNKS / 2;
+    world.spawned.assign(WORLD_WINDOW_CHUNKS * WORLD_WINDOW_CHUNKS, false);
+
+    level.width  = WORLD_WINDOW_CHUNKS * CHUNK_SIZE;
+    level.height = WORLD_WINDOW_CHUNKS * CHUNK_SIZE;
+    if (level.tiles)
+    {
+        delete[] level.tiles;
+    }
+    level.tiles = new Tile[level.width * level.height];
+    level.random = generator_random(seed, GENERATOR_STREAM_MONSTERS, 0);
+    clear_entities(&level.entities);
+
+    // The first window is generated right away, there's nothing to show before it.
+    std::vector<World_Chunk*> chunks;
+    for (int y = 0; y < WORLD_WINDOW_CHUNKS; y++)
+    {
+        for (int x = 0; x < WORLD_WINDOW_CHUNKS; x++)
+        {
+            chunks.push_back(new_world_chunk(world.origin_x + x, world.origin_y + y));
+        }
+    }
+    parallel_for((int) chunks.size(), generate_world_chunk_job, chunks.data());
+
+    for (World_Chunk* chunk : chunks)
+    {
+        chunk->ready = true;
+    }
+    for (int y = 0; y < WORLD_WINDOW_CHUNKS; y++)
+    {
+        for (int x = 0; x < WORLD_WINDOW_CHUNKS; x++)
+        {
+            fill_window_chunk(x, y);
+        }
+    }
+
+    tiles_changed(0, 0, level.width - 1, level.height - 1);
+
+    // The player starts at the spawn cell closest to the middle, out of the largest region in the window so
+    // it isn't shut in a small pocket.
+    Spawn_Regions regions = {};
+    find_spawn_regions(&level.solid, &regions);
+    int region = find_largest_region(&regions);
+
+    Vector2 middle = vector2(level.width * 0.5f, level.height * 0.5f);
+    Vector2 start = middle;
+    float best_distance = FLT_MAX;
+    if (region >= 0)
+    {
+        for (int i = regions.region_start[region]; i < regions.region_start[region + 1]; i++)
+        {
+            int cell = regions.cells[i];
+            Vector2 position = vector2(cell % level.width + 1, cell / level.width + 1);
+            float distance = length(position - middle);
+            if (distance < best_distance)
+            {
+                best_distance = distance;
+                start = position;
+            }
+        }
+    }
+
+    Entity player = {};
+    player.brain = BRAIN_PLAYER;
+    player.size = vector2(1.7, 1.7);
+    player.position = start - 0.5 * player.size;
+    player.texture = the_game->art.white;
+    player.health = 10;
+    player.max_health = 10;
+    add_entity(&level.entities, player);
+
+    level.camera_position = player.position;
+    level.previous_camera_position = player.position;
+    level.target_camera_position = player.position;
+
+    spawn_world_monsters();
+}
+
+// Moves the window by whole chunks and shifts the level the other way. Entities that end up outside the
+// window are dropped, they come back when their chunk is filled in again.
+static void shift_world(int chunks_x, int chunks_y)
+{
+    auto& world = the_game->world;
+    auto& level = the_game->level;
+    auto& entities = level.entities;
+
+    world.origin_x += chunks_x;
+    world.origin_y += chunks_y;
+
+    Vector2 offset = vector2(-chunks_x * CHUNK_SIZE, -chunks_y * CHUNK_SIZE);
+    for (int entity_index = 0; entity_index < entities.count; entity_index++)
+    {
+        Vector2& position = entities.position[entity_index];
+        position += offset;
+        entities.previous_position[entity_index] += offset;
+
+        if (position.x < 0 || position.x >= level.width ||
+            position.y < 0 || position.y >= level.height)
+        {
+            remove_entity_later(&entities, entity_index);
+        }
+    }
+    remove_queued_entities(&entities);
+
+    level.camera_position += offset;
+    level.previous_camera_position += offset;
+    level.target_camera_position += offset;
+
+    std::vector<uint8> spawned(world.spawned.size(), false);
+    for (int y = 0; y < WORLD_WINDOW_CHUNKS; y++)
+    {
+        for (int x = 0; x < WORLD_WINDOW_CHUNKS; x++)
+        {
+            int old_x = x + chunks_x;
+            int old_y = y + chunks_y;
+            if (old_x >= 0 && old_x < WORLD_WINDOW_CHUNKS && old_y >= 0 && old_y < WORLD_WINDOW_CHUNKS)
+            {
+                spawned[y * WORLD_WINDOW_CHUNKS + x] = world.spawned[old_y * WORLD_WINDOW_CHUNKS + old_x];
+            }
+        }
+    }
+    world.spawned = spawned;
+
+    for (int y = 0; y < WORLD_WINDOW_CHUNKS; y++)
+    {
+        for (int x = 0; x < WORLD_WINDOW_CHUNKS; x++)
+        {
+            fill_window_chunk(x, y);
+        }
+    }
+
+    tiles_changed(0, 0, level.width - 1, level.height - 1);
+}
+
+static void evict_world_chunks()
+{
+    auto& world = the_game->world;
+    if ((int) world.chunks.size() <= WORLD_CHUNK_BUDGET) return;
+
+    // Only ready chunks that weren't used this frame can go, which keeps the window and the ones around it.
+    std::vector<World_Chunk*> candidates;
+    for (auto& entry : world.chunks)
+    {
+        World_Chunk* chunk = entry.second;
+        if (chunk->ready && chunk->last_used != world.frame)
+        {
+            candidates.push_back(chunk);
+        }
+    }
+
+    int evict_count = min_i32((int) world.chunks.size() - WORLD_CHUNK_BUDGET, (int) candidates.size());
+    std::nth_element(candidates.begin(), candidates.begin() + evict_count, candidates.end(),
+                     [](World_Chunk* a, World_Chunk* b) { return a->last_used < b->last_used; });
+
+    for (int i = 0; i < evict_count; i++)
+    {
+        World_Chunk* chunk = candidates[i];
+        world.chunks.erase(get_world_chunk_key(chunk->chunk_x, chunk->chunk_y));
+        delete chunk;
+    }
+}
+
+// Called once a frame while the world is enabled.
+void stream_world()
+{
+    auto& world = the_game->world;
+    auto& level = the_game->level;
+    World_Generator* generator = get_world_generator();
+    world.frame++;
+
+    std::vector<World_Chunk*> finished;
+    {
+        std::lock_guard<std::mutex> lock(generator->mutex);
+        finished.swap(generator->finished);
+    }
+
+    for (World_Chunk* chunk : finished)
+    {
+        if (chunk->world_id != world.id)
+        {
+            delete chunk;
+            continue;
+        }
+
+        chunk->ready = true;
+        int window_x = chunk->chunk_x - world.origin_x;
+        int window_y = chunk->chunk_y - world.origin_y;
+        if (window_x >= 0 && window_x < WORLD_WINDOW_CHUNKS && window_y >= 0 && window_y < WORLD_WINDOW_CHUNKS)
+        {
+            fill_window_chunk(window_x, window_y);
+            tiles_changed(window_x * CHUNK_SIZE, window_y * CHUNK_SIZE,
+                          window_x * CHUNK_SIZE + CHUNK_SIZE - 1, window_y * CHUNK_SIZE + CHUNK_SIZE - 1);
+        }
+    }
+
+    // Keep the camera within a chunk of the middle of the window.
+    int camera_x = (int) floorf(level.camera_position.x / CHUNK_SIZE);
+    int camera_y = (int) floorf(level.camera_position.y / CHUNK_SIZE);
+    int shift_x = camera_x - WORLD_WINDOW_CHUNKS / 2;
+    int shift_y = camera_y - WORLD_WINDOW_CHUNKS / 2;
+    if (abs(shift_x) > 1 || abs(shift_y) > 1)
+    {
+        shift_world(shift_x, shift_y);
+        camera_x -= shift_x;
+        camera_y -= shift_y;
+    }
+
+    spawn_world_monsters();
+
+    // Request everything in and around the window that isn't there yet, closest to the camera first.
+    std::vector<World_Chunk*> requests;
+    for (int y = -WORLD_PREFETCH_CHUNKS; y < WORLD_WINDOW_CHUNKS + WORLD_PREFETCH_CHUNKS; y++)
+    {
+        for (int x = -WORLD_PREFETCH_CHUNKS; x < WORLD_WINDOW_CHUNKS + WORLD_PREFETCH_CHUNKS; x++)
+        {
+            World_Chunk* chunk = find_world_chunk(world.origin_x + x, world.origin_y + y);
+            if (chunk)
+            {
+                chunk->last_used = world.frame;
+            }
+            else
+            {
+                requests.push_back(new_world_chunk(world.origin_x + x, world.origin_y + y));
+            }
+        }
+    }
+
+    if (!requests.empty())
+    {
+        int center_x = world.origin_x + camera_x;
+        int center_y = world.origin_y + camera_y;
+        std::sort(requests.begin(), requests.end(), [=](World_Chunk* a, World_Chunk* b)
+        {
+            int distance_a = max_i32(abs(a->chunk_x - center_x), abs(a->chunk_y - center_y));
+            int distance_b = max_i32(abs(b->chunk_x - center_x), abs(b->chunk_y - center_y));
+            return distance_a < distance_b;
+        });
+
+        {
+            std::lock_guard<std::mutex> lock(generator->mutex);
+            generator->requests.insert(generator->requests.end(), requests.begin(), requests.end());
+        }
+        generator->wake.notify_all();
+    }
+
+    evict_world_chunks();
+}
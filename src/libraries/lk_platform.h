@@ -22,10 +22,16 @@ DOCUMENTATION
 #ifndef LK_PLATFORM_HEADER
 #define LK_PLATFORM_HEADER
 
+#ifdef _WIN32
+#define LK__EXPORT __declspec(dllexport)
+#else
+#define LK__EXPORT __attribute__((visibility("default")))
+#endif
+
 #ifdef __cplusplus
-#define LK_CLIENT_EXPORT extern "C" __declspec(dllexport)
+#define LK_CLIENT_EXPORT extern "C" LK__EXPORT
 #else
-#define LK_CLIENT_EXPORT __declspec(dllexport)
+#define LK_CLIENT_EXPORT LK__EXPORT
 #endif
 
 #ifdef __cplusplus
@@ -35,13 +41,20 @@ extern "C"
 
 typedef signed char  LK_S8;
 typedef signed short LK_S16;
-typedef signed long  LK_S32;
 
 typedef unsigned char      LK_U8;
 typedef unsigned short     LK_U16;
-typedef unsigned long      LK_U32;
 typedef unsigned long long LK_U64;
 
+#ifdef _WIN32
+typedef signed long   LK_S32;
+typedef unsigned long LK_U32;
+#else
+// long is 64 bits wide on LP64 systems.
+typedef signed int   LK_S32;
+typedef unsigned int LK_U32;
+#endif
+
 typedef LK_U8  LK_B8;
 typedef LK_U16 LK_B16;
 typedef LK_U32 LK_B32;
@@ -199,6 +212,15 @@ typedef struct
     LK_F32 volume;
 } LK_Sound;
 
+typedef struct
+{
+    const LK_U8* data;
+    LK_U64 size;
+} LK_Mapped_File;
+
+typedef LK_B32 LK_Map_File_Function(const char* path, LK_Mapped_File* file);
+typedef void LK_Unmap_File_Function(LK_Mapped_File* file);
+
 enum
 {
     LK_MIXER_SLOT_COUNT = 32,
@@ -294,6 +316,14 @@ typedef struct LK_Platform_Structure
         LK_U64 milliseconds;
         LK_F64 seconds;
     } time;
+
+    // Maps a whole file into memory, read only, so the client doesn't need the system headers for it.
+    // Returns 0 if the file can't be opened or is empty. The mapping stays valid until it's unmapped.
+    struct
+    {
+        LK_Map_File_Function* map;
+        LK_Unmap_File_Function* unmap;
+    } file;
 } LK_Platform;
 
 #ifdef __cplusplus
@@ -326,19 +356,29 @@ extern "C"
 #endif
 
 
+#ifdef _WIN32
 #include <windows.h> // @Incomplete - get rid of this include
 #include <dsound.h> // @Incomplete - get rid of this include
 #include <dwmapi.h> // @Incomplete - get rid of this include
+#else
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 
 typedef void LK_Client_Init_Function(LK_Platform* platform);
 typedef void LK_Client_Close_Function(LK_Platform* platform);
+typedef void LK_Client_Unload_Function(LK_Platform* platform);
 typedef void LK_Client_Frame_Function(LK_Platform* platform);
 typedef void LK_Client_Audio_Function(LK_Platform* platform, LK_S16* samples);
 
-typedef HGLRC WGLCreateContextAttribsARB(HDC hDC, HGLRC hShareContext, const int* attribList);
-typedef BOOL WGLSwapIntervalEXT(int interval);
-
 enum
 {
     LK_MAX_TEXT_SIZE = 256,
@@ -363,6 +403,12 @@ typedef struct
     LK_F64 cursor_step;
 } LK_Playing_Sound;
 
+
+#ifdef _WIN32
+
+typedef HGLRC WGLCreateContextAttribsARB(HDC hDC, HGLRC hShareContext, const int* attribList);
+typedef BOOL WGLSwapIntervalEXT(int interval);
+
 typedef struct
 {
     struct
@@ -374,6 +420,7 @@ typedef struct
         HMODULE library;
         LK_Client_Init_Function* init;
         LK_Client_Close_Function* close;
+        LK_Client_Unload_Function* unload;
         LK_Client_Frame_Function* frame;
         LK_Client_Audio_Function* audio;
     } client;
@@ -447,6 +494,7 @@ static LK_Platform_Private lk_private;
 static void lk_client_init_stub(LK_Platform* platform) {}
 static void lk_client_frame_stub(LK_Platform* platform) {}
 static void lk_client_close_stub(LK_Platform* platform) {}
+static void lk_client_unload_stub(LK_Platform* platform) {}
 
 static void lk_client_audio_stub(LK_Platform* platform, LK_S16* samples)
 {
@@ -518,6 +566,7 @@ static void lk_load_client()
 
         LK_GetClientFunction(lk_private.client.init,  LK_Client_Init_Function,  lk_client_init);
         LK_GetClientFunction(lk_private.client.close, LK_Client_Close_Function, lk_client_close);
+        LK_GetClientFunction(lk_private.client.unload, LK_Client_Unload_Function, lk_client_unload);
         LK_GetClientFunction(lk_private.client.frame, LK_Client_Frame_Function, lk_client_frame);
         LK_GetClientFunction(lk_private.client.audio, LK_Client_Audio_Function, lk_client_audio);
 
@@ -529,10 +578,14 @@ static void lk_load_client()
     }
 }
 
+// The client's unload runs first, so it can stop anything that would go on running the library's code,
+// like threads. It's called on every unload, for a hot reload and at exit.
 static void lk_unload_client()
 {
     if (lk_private.client.library)
     {
+        lk_private.client.unload(&lk_platform);
+
         if (!FreeLibrary(lk_private.client.library))
         {
             /* @Incomplete - logging */
@@ -542,6 +595,37 @@ static void lk_unload_client()
     }
 }
 
+static LK_B32 lk_map_file(const char* path, LK_Mapped_File* mapped)
+{
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return 0;
+
+    // The mapping keeps the file open, so both handles can be closed right away.
+    LARGE_INTEGER size;
+    HANDLE mapping = NULL;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+    {
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+    CloseHandle(file);
+    if (!mapping) return 0;
+
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!data) return 0;
+
+    mapped->data = (const LK_U8*) data;
+    mapped->size = size.QuadPart;
+    return 1;
+}
+
+static void lk_unmap_file(LK_Mapped_File* mapped)
+{
+    UnmapViewOfFile(mapped->data);
+    mapped->data = 0;
+    mapped->size = 0;
+}
+
 static LONG lk_apply_window_style(LONG old_style, LK_B32 ignore_fullscreen)
 {
     LONG resizable_flags = WS_THICKFRAME | WS_MAXIMIZEBOX;
@@ -1882,6 +1966,9 @@ static void lk_entry()
     lk_platform.window.x = LK_DEFAULT_POSITION;
     lk_platform.window.y = LK_DEFAULT_POSITION;
 
+    lk_platform.file.map = lk_map_file;
+    lk_platform.file.unmap = lk_unmap_file;
+
     lk_load_client();
 
     lk_initialize_timer();
@@ -1942,6 +2029,652 @@ int main(int argc, char** argv)
 }
 #endif
 
+#else // _WIN32
+
+// There's no window or audio device support on Linux yet, only what it takes to run the client headless,
+// for servers and benchmarks:
+//   * window.no_window is set before the client's init is called, and the frame loop never opens a window.
+//     If the client asks for LK_WINDOW_CANVAS, the canvas is still allocated, as plain memory.
+//   * Audio is mixed on the frame loop's clock and thrown away, or appended to a WAV file if the
+//     LK_AUDIO_FILE environment variable names one.
+//   * If LK_FRAME_COUNT is set, the frame loop stops after that many frames and prints the frame rate.
+//
+// The client is loaded from LK_PLATFORM_DLL_NAME ".so" next to the executable and reloaded when that
+// file changes, same as the DLL on Windows. Build it with -shared -fPIC, and the platform with -ldl.
+
+typedef struct
+{
+    struct
+    {
+        struct timespec last_dll_write_time;
+        char dll_path[4096];
+        char temp_dll_path[4096];
+
+        void* library;
+        LK_Client_Init_Function* init;
+        LK_Client_Close_Function* close;
+        LK_Client_Unload_Function* unload;
+        LK_Client_Frame_Function* frame;
+        LK_Client_Audio_Function* audio;
+    } client;
+
+    struct
+    {
+        int text_size;
+        char text_buffer[LK_MAX_TEXT_SIZE];
+    } keyboard;
+
+    struct
+    {
+        LK_S16* sample_buffer;
+        LK_U64 mixed_sample_count;
+
+        FILE* file;
+        LK_U32 file_data_size;
+
+        // Everything runs on the frame loop's thread, so unlike on Windows the mixer needs no lock.
+        LK_Playing_Sound mixer_slots[LK_MIXER_SLOT_COUNT];
+    } audio;
+
+    struct
+    {
+        LK_U64 initial_ticks;
+        LK_U64 ticks_per_second;
+
+        LK_U64 unprocessed_nanoseconds;
+        LK_U64 unprocessed_microseconds;
+        LK_U64 unprocessed_milliseconds;
+    } time;
+} LK_Platform_Private;
+
+static LK_Platform lk_platform;
+static LK_Platform_Private lk_private;
+
+
+static void lk_client_init_stub(LK_Platform* platform) {}
+static void lk_client_frame_stub(LK_Platform* platform) {}
+static void lk_client_close_stub(LK_Platform* platform) {}
+static void lk_client_unload_stub(LK_Platform* platform) {}
+
+static void lk_client_audio_stub(LK_Platform* platform, LK_S16* samples)
+{
+    memset(samples, 0, platform->audio.sample_count * platform->audio.channels * 2);
+}
+
+static void lk_get_dll_paths()
+{
+    const char dll_name[] = LK_PLATFORM_DLL_NAME ".so";
+    const char temp_dll_name[] = LK_PLATFORM_TEMP_DLL_NAME ".so";
+
+    char* dll_path = lk_private.client.dll_path;
+    char* temp_dll_path = lk_private.client.temp_dll_path;
+    size_t path_size = sizeof(lk_private.client.dll_path);
+
+    ssize_t directory_length = readlink("/proc/self/exe", dll_path, path_size - 1);
+    if (directory_length < 0)
+    {
+        directory_length = 0;
+    }
+
+    while (directory_length > 0 && dll_path[directory_length - 1] != '/')
+        directory_length--;
+
+    if (directory_length + sizeof(temp_dll_name) > path_size)
+    {
+        /* @Incomplete - logging */
+        directory_length = 0;
+    }
+
+    memcpy(dll_path + directory_length, dll_name, sizeof(dll_name));
+    memcpy(temp_dll_path, dll_path, directory_length);
+    memcpy(temp_dll_path + directory_length, temp_dll_name, sizeof(temp_dll_name));
+}
+
+static LK_B32 lk_check_client_reload()
+{
+    struct timespec file_time;
+    memset(&file_time, 0, sizeof(file_time));
+
+    struct stat file_stat;
+    if (stat(lk_private.client.dll_path, &file_stat) == 0)
+    {
+        file_time = file_stat.st_mtim;
+    }
+
+    struct timespec* last = &lk_private.client.last_dll_write_time;
+    if (file_time.tv_sec != last->tv_sec || file_time.tv_nsec != last->tv_nsec)
+    {
+        *last = file_time;
+        return 1;
+    }
+
+    return 0;
+}
+
+static LK_B32 lk_copy_file(const char* from, const char* to)
+{
+    FILE* source = fopen(from, "rb");
+    if (!source)
+    {
+        return 0;
+    }
+
+    FILE* destination = fopen(to, "wb");
+    if (!destination)
+    {
+        fclose(source);
+        return 0;
+    }
+
+    char buffer[65536];
+    size_t size;
+    while ((size = fread(buffer, 1, sizeof(buffer), source)) > 0)
+    {
+        fwrite(buffer, 1, size, destination);
+    }
+
+    fclose(source);
+    fclose(destination);
+    return 1;
+}
+
+static void lk_load_client()
+{
+    char* dll_path = lk_private.client.dll_path;
+    char* temp_dll_path = lk_private.client.temp_dll_path;
+
+    // The copy gets a new inode, so dlopen doesn't hand back the library that was just closed.
+    unlink(temp_dll_path);
+    if (!lk_copy_file(dll_path, temp_dll_path))
+    {
+        /* @Incomplete - logging */
+    }
+
+    void* library = dlopen(temp_dll_path, RTLD_NOW | RTLD_LOCAL);
+    lk_private.client.library = library;
+
+    // Without init and frame the client can't run. A frame counted run is a test, so instead of going on
+    // with the stubs and exiting with 0 it fails right away.
+    LK_B32 failed = 0;
+    if (library)
+    {
+        #define LK_GetClientFunction(ptr, type, name, required)                 \
+            ptr = (type*) dlsym(library, #name);                                \
+            if (!ptr)                                                           \
+            {                                                                   \
+                if (required)                                                   \
+                {                                                               \
+                    fprintf(stderr, "lk_platform: %s\n", dlerror());            \
+                    failed = 1;                                                 \
+                }                                                               \
+                ptr = name##_stub;                                              \
+            }
+
+        LK_GetClientFunction(lk_private.client.init,  LK_Client_Init_Function,  lk_client_init,  1);
+        LK_GetClientFunction(lk_private.client.close, LK_Client_Close_Function, lk_client_close, 0);
+        LK_GetClientFunction(lk_private.client.unload, LK_Client_Unload_Function, lk_client_unload, 0);
+        LK_GetClientFunction(lk_private.client.frame, LK_Client_Frame_Function, lk_client_frame, 1);
+        LK_GetClientFunction(lk_private.client.audio, LK_Client_Audio_Function, lk_client_audio, 0);
+
+        #undef LK_GetClientFunction
+    }
+    else
+    {
+        fprintf(stderr, "lk_platform: %s\n", dlerror());
+        failed = 1;
+
+        lk_private.client.init  = lk_client_init_stub;
+        lk_private.client.close = lk_client_close_stub;
+        lk_private.client.unload = lk_client_unload_stub;
+        lk_private.client.frame = lk_client_frame_stub;
+        lk_private.client.audio = lk_client_audio_stub;
+    }
+
+    if (failed && getenv("LK_FRAME_COUNT"))
+    {
+        fprintf(stderr, "lk_platform: failed to load the client %s\n", dll_path);
+        exit(1);
+    }
+}
+
+// See the Windows version.
+static LK_B32 lk_map_file(const char* path, LK_Mapped_File* mapped)
+{
+    int file = open(path, O_RDONLY);
+    if (file < 0) return 0;
+
+    struct stat info;
+    void* data = MAP_FAILED;
+    if (fstat(file, &info) == 0 && info.st_size > 0)
+    {
+        data = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    }
+    close(file);
+    if (data == MAP_FAILED) return 0;
+
+    mapped->data = (const LK_U8*) data;
+    mapped->size = info.st_size;
+    return 1;
+}
+
+static void lk_unmap_file(LK_Mapped_File* mapped)
+{
+    munmap((void*) mapped->data, mapped->size);
+    mapped->data = 0;
+    mapped->size = 0;
+}
+
+// See the Windows version.
+static void lk_unload_client()
+{
+    if (lk_private.client.library)
+    {
+        lk_private.client.unload(&lk_platform);
+
+        if (dlclose(lk_private.client.library) != 0)
+        {
+            /* @Incomplete - logging */
+        }
+
+        lk_private.client.library = 0;
+    }
+}
+
+static void lk_update_canvas()
+{
+    LK_U32 width = lk_platform.window.width;
+    LK_U32 height = lk_platform.window.height;
+
+    if (width != lk_platform.canvas.width || height != lk_platform.canvas.height)
+    {
+        free(lk_platform.canvas.data);
+
+        LK_U32 bytes_per_pixel = 4;
+        lk_platform.canvas.data = (LK_U8*) calloc(1, width * height * bytes_per_pixel);
+        lk_platform.canvas.width = width;
+        lk_platform.canvas.height = height;
+    }
+}
+
+static void lk_push()
+{
+    lk_platform.mouse.delta_x = 0;
+    lk_platform.mouse.delta_y = 0;
+    lk_platform.mouse.delta_wheel = 0;
+
+    lk_private.keyboard.text_size = 0;
+    lk_private.keyboard.text_buffer[0] = 0;
+    lk_platform.keyboard.text = lk_private.keyboard.text_buffer;
+}
+
+static void lk_pull()
+{
+    if (lk_platform.window.backend == LK_WINDOW_CANVAS)
+    {
+        lk_update_canvas();
+    }
+}
+
+static void lk_initialize_timer()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    lk_private.time.ticks_per_second = 1000000000;
+    lk_private.time.initial_ticks = (LK_U64) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void lk_update_time_stamp()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    LK_U64 frequency = lk_private.time.ticks_per_second;
+    LK_U64 new_ticks = (LK_U64) now.tv_sec * 1000000000 + now.tv_nsec - lk_private.time.initial_ticks;
+    LK_U64 delta_ticks = new_ticks - lk_platform.time.ticks;
+
+    lk_platform.time.delta_ticks = delta_ticks;
+
+    LK_U64 nanoseconds_ticks = 1000000000 * delta_ticks + lk_private.time.unprocessed_nanoseconds;
+    lk_platform.time.delta_nanoseconds = nanoseconds_ticks / frequency;
+    lk_private.time.unprocessed_nanoseconds = nanoseconds_ticks % frequency;
+
+    LK_U64 microseconds_ticks = 1000000 * delta_ticks + lk_private.time.unprocessed_microseconds;
+    lk_platform.time.delta_microseconds = microseconds_ticks / frequency;
+    lk_private.time.unprocessed_microseconds = microseconds_ticks % frequency;
+
+    LK_U64 milliseconds_ticks = 1000 * delta_ticks + lk_private.time.unprocessed_milliseconds;
+    lk_platform.time.delta_milliseconds = milliseconds_ticks / frequency;
+    lk_private.time.unprocessed_milliseconds = milliseconds_ticks % frequency;
+
+    lk_platform.time.delta_seconds = (LK_F64) delta_ticks / (LK_F64) frequency;
+
+    lk_platform.time.ticks        += delta_ticks;
+    lk_platform.time.nanoseconds  += lk_platform.time.delta_nanoseconds;
+    lk_platform.time.microseconds += lk_platform.time.delta_microseconds;
+    lk_platform.time.milliseconds += lk_platform.time.delta_milliseconds;
+    lk_platform.time.seconds      += lk_platform.time.delta_seconds;
+}
+
+static void lk_mixer_synchronize()
+{
+    if (lk_platform.audio.strategy != LK_AUDIO_MIXER)
+    {
+        return;
+    }
+
+    LK_F64 playing_frequency = (LK_F64) lk_platform.audio.frequency;
+
+    for (int sound_index = 0; sound_index < LK_MIXER_SLOT_COUNT; sound_index++)
+    {
+        LK_Sound* user = lk_platform.audio.mixer_slots + sound_index;
+        LK_Playing_Sound* live = lk_private.audio.mixer_slots + sound_index;
+
+        LK_B32 playing = user->playing;
+        switch (live->state)
+        {
+        case LK_NOT_PLAYING:
+        {
+            if (playing)
+            {
+                live->state = LK_PLAYING;
+                live->wave = user->wave;
+                live->loop = user->loop;
+                live->volume = user->volume;
+                live->cursor = 0;
+                live->cursor_step = user->wave.frequency / playing_frequency;
+            }
+        } break;
+        case LK_PLAYING:
+        {
+            if (!playing)
+            {
+                live->state = LK_NOT_PLAYING;
+            }
+            else
+            {
+                live->volume = user->volume;
+            }
+        } break;
+        case LK_FINISHED:
+        {
+            live->state = LK_NOT_PLAYING;
+            user->playing = 0;
+        } break;
+        }
+    }
+}
+
+static void lk_mix(LK_Platform* unused, LK_S16* output)
+{
+    LK_U32 output_channels = lk_platform.audio.channels;
+    LK_U32 output_count = lk_platform.audio.sample_count;
+    LK_Playing_Sound* slots = lk_private.audio.mixer_slots;
+
+    LK_S32 sound_count;
+    LK_F32 samples_sum[8];
+    while (output_count--)
+    {
+        sound_count = 0;
+        memset(samples_sum, 0, output_channels * sizeof(LK_F32));
+
+        for (int sound_index = 0; sound_index < LK_MIXER_SLOT_COUNT; sound_index++)
+        {
+            LK_Playing_Sound* sound = slots + sound_index;
+            if (sound->state != LK_PLAYING) continue;
+            sound_count++;
+
+            LK_U32 count = sound->wave.count;
+            LK_U32 channels = sound->wave.channels;
+            LK_F32 volume = sound->volume;
+
+            LK_U32 cursor = (LK_U32) sound->cursor;
+            sound->cursor += sound->cursor_step;
+            if ((LK_U32) sound->cursor >= count)
+            {
+                if (sound->loop)
+                {
+                    sound->cursor = 0;
+                }
+                else
+                {
+                    sound->state = LK_FINISHED;
+                }
+            }
+
+            LK_S16* source = sound->wave.samples + (cursor * channels);
+            if (channels == output_channels)
+            {
+                for (int channel = 0; channel < channels; channel++)
+                    samples_sum[channel] += (LK_F32)(*(source++)) * volume;
+            }
+            else if (output_channels == 1)
+            {
+                LK_S32 single = 0;
+                for (int channel = 0; channel < channels; channel++)
+                    single += *(source++);
+                samples_sum[0] += ((LK_F32) single / (LK_F32) channels) * volume;
+            }
+            else
+            {
+                for (int channel = 0; channel < output_channels; channel++)
+                    samples_sum[channel] += (LK_F32)(*source) * volume;
+            }
+        }
+
+        if (!sound_count)
+        {
+            // Fill the remainder of the output buffer with silence, there are no more sounds to play.
+            memset(output, 0, (output_count + 1) * output_channels * sizeof(LK_S16));
+            break;
+        }
+
+        for (int channel_index = 0; channel_index < output_channels; channel_index++)
+        {
+            LK_S32 clamped = samples_sum[channel_index];
+            if (clamped < -32767) clamped = -32767;
+            if (clamped >  32767) clamped =  32767;
+
+            *(output++) = (LK_S16) clamped;
+        }
+    }
+}
+
+static void lk_write_wave_header(FILE* file, LK_U32 data_size)
+{
+    LK_U32 channels = lk_platform.audio.channels;
+    LK_U32 frequency = lk_platform.audio.frequency;
+
+    LK_U32 riff_size = 36 + data_size;
+    LK_U32 format_size = 16;
+    LK_U16 encoding = 1; // PCM
+    LK_U16 channel_count = (LK_U16) channels;
+    LK_U32 byte_rate = frequency * channels * 2;
+    LK_U16 block_align = (LK_U16)(channels * 2);
+    LK_U16 bits_per_sample = 16;
+
+    fseek(file, 0, SEEK_SET);
+    fwrite("RIFF", 4, 1, file);
+    fwrite(&riff_size, 4, 1, file);
+    fwrite("WAVEfmt ", 8, 1, file);
+    fwrite(&format_size, 4, 1, file);
+    fwrite(&encoding, 2, 1, file);
+    fwrite(&channel_count, 2, 1, file);
+    fwrite(&frequency, 4, 1, file);
+    fwrite(&byte_rate, 4, 1, file);
+    fwrite(&block_align, 2, 1, file);
+    fwrite(&bits_per_sample, 2, 1, file);
+    fwrite("data", 4, 1, file);
+    fwrite(&data_size, 4, 1, file);
+    fseek(file, 0, SEEK_END);
+}
+
+static void lk_initialize_audio()
+{
+    if (!lk_platform.audio.frequency)    lk_platform.audio.frequency = 44100;
+    if (!lk_platform.audio.channels)     lk_platform.audio.channels = 2;
+    if (!lk_platform.audio.sample_count) lk_platform.audio.sample_count = 2048;
+
+    if (lk_platform.audio.channels > 8)
+    {
+        /* @Incomplete - logging */
+        lk_platform.audio.strategy = LK_NO_AUDIO;
+        return;
+    }
+
+    LK_U32 sample_buffer_size = lk_platform.audio.sample_count * lk_platform.audio.channels * 2;
+    lk_private.audio.sample_buffer = (LK_S16*) malloc(sample_buffer_size);
+
+    const char* path = getenv("LK_AUDIO_FILE");
+    if (path && *path)
+    {
+        FILE* file = fopen(path, "wb");
+        if (file)
+        {
+            lk_write_wave_header(file, 0);
+            lk_private.audio.file = file;
+        }
+        else
+        {
+            fprintf(stderr, "lk_platform: failed to open %s for writing\n", path);
+        }
+    }
+}
+
+// Mixes as many buffers as fit in the time that has passed since the audio was initialized, so the
+// mixer advances at the same rate it would if a device was pulling samples.
+static void lk_update_audio()
+{
+    LK_Audio_Strategy strategy = lk_platform.audio.strategy;
+    if (strategy == LK_NO_AUDIO)
+    {
+        return;
+    }
+
+    LK_U32 sample_count = lk_platform.audio.sample_count;
+    LK_U32 buffer_size = sample_count * lk_platform.audio.channels * 2;
+    LK_S16* buffer = lk_private.audio.sample_buffer;
+
+    LK_U64 due_sample_count = lk_platform.time.microseconds * lk_platform.audio.frequency / 1000000;
+    while (lk_private.audio.mixed_sample_count + sample_count <= due_sample_count)
+    {
+        if (strategy == LK_AUDIO_CALLBACK)
+        {
+            lk_private.client.audio(&lk_platform, buffer);
+        }
+        else
+        {
+            lk_mix(&lk_platform, buffer);
+        }
+
+        lk_private.audio.mixed_sample_count += sample_count;
+
+        if (lk_private.audio.file)
+        {
+            fwrite(buffer, buffer_size, 1, lk_private.audio.file);
+            lk_private.audio.file_data_size += buffer_size;
+        }
+    }
+}
+
+static void lk_close_audio()
+{
+    FILE* file = lk_private.audio.file;
+    if (file)
+    {
+        lk_write_wave_header(file, lk_private.audio.file_data_size);
+        fclose(file);
+        lk_private.audio.file = 0;
+    }
+
+    free(lk_private.audio.sample_buffer);
+    lk_private.audio.sample_buffer = 0;
+}
+
+static void lk_entry()
+{
+    lk_get_dll_paths();
+    lk_check_client_reload();
+
+    lk_platform.window.x = LK_DEFAULT_POSITION;
+    lk_platform.window.y = LK_DEFAULT_POSITION;
+    lk_platform.window.no_window = 1;
+
+    lk_platform.file.map = lk_map_file;
+    lk_platform.file.unmap = lk_unmap_file;
+
+    lk_load_client();
+
+    lk_initialize_timer();
+    lk_private.client.init(&lk_platform);
+
+    // There's no monitor to size a default window from.
+    if (!lk_platform.window.width)  lk_platform.window.width = 1280;
+    if (!lk_platform.window.height) lk_platform.window.height = 720;
+    lk_platform.window.no_window = 1;
+
+    if (lk_platform.audio.strategy != LK_NO_AUDIO)
+    {
+        lk_initialize_audio();
+    }
+
+    LK_U64 frame_limit = 0;
+    const char* frame_count_string = getenv("LK_FRAME_COUNT");
+    if (frame_count_string)
+    {
+        frame_limit = strtoull(frame_count_string, 0, 10);
+    }
+
+    LK_U64 frame_count = 0;
+    while (!lk_platform.break_frame_loop)
+    {
+        if (lk_check_client_reload())
+        {
+            lk_unload_client();
+            lk_load_client();
+        }
+
+        lk_push();
+        lk_pull();
+
+        lk_update_time_stamp();
+        lk_private.client.frame(&lk_platform);
+
+        lk_mixer_synchronize();
+        lk_update_audio();
+
+        frame_count++;
+        if (frame_limit && frame_count >= frame_limit)
+        {
+            break;
+        }
+    }
+
+    lk_update_time_stamp();
+    lk_private.client.close(&lk_platform);
+
+    if (frame_limit)
+    {
+        LK_F64 seconds = lk_platform.time.seconds;
+        fprintf(stderr, "lk_platform: %llu frames in %.3f s, %.3f ms per frame\n",
+                (unsigned long long) frame_count, seconds, seconds * 1000.0 / (LK_F64) frame_count);
+    }
+
+    lk_close_audio();
+    lk_unload_client();
+    unlink(lk_private.client.temp_dll_path);
+}
+
+#ifndef LK_PLATFORM_NO_MAIN
+int main(int argc, char** argv)
+{
+    lk_entry();
+    return 0;
+}
+#endif
+
+#endif // _WIN32
+
 #ifdef __cplusplus
 }
 #endif